@@ -1,8 +1,36 @@
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define LISPY_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LISPY_THREADS
+#include <pthread.h>
+#endif
+
+/* SIMD kernels for the reader and the packed vectors, chosen at runtime */
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define LVEC_X86
+#include <immintrin.h>
+#define LVEC_SSE2 __attribute__((target("sse2")))
+#define LVEC_AVX2 __attribute__((target("avx2")))
+#endif
+
 #ifdef _WIN32
 #include <string.h>
 
@@ -43,26 +71,55 @@ void add_history(char *unused) {}
   LASSERT(args, args->count == expected,                                       \
           "Function '%s' passed too many arguments! "                          \
           "got %i, expected %i",                                               \
-          args->count, expected);
+          func, args->count, expected);
+
+/* sources up to this size are loaded through the cache, larger ones are
+ * streamed through the reader */
+#define LCACHE_MAX_SOURCE (16L << 20)
 
 struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
 
-/* Create Enumeration of Possible lval Types */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
-/* Create Enumeration of Possible Error Types */
-enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
+/* Create Enumeration of Possible lval Types. Caches and images store
+ * these values as node types, so reordering them needs LCACHE_VERSION
+ * bumped */
+enum {
+  LVAL_NUM,
+  LVAL_BIGNUM,
+  LVAL_DBL,
+  LVAL_ERR,
+  LVAL_SYM,
+  LVAL_STR,
+  LVAL_FUN,
+  LVAL_SEXPR,
+  LVAL_QEXPR,
+  LVAL_I64VEC,
+  LVAL_F64VEC
+};
+/* Create Enumeration of Arithmetic and Ordering Operators */
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV };
+enum { LORD_GT, LORD_GE, LORD_LT, LORD_LE };
 
 /* Declare New Lisp Value struct */
 typedef lval *(*lbuiltin)(lenv *, lval *);
 
+/* arbitrary precision integer, the magnitude is stored in base 2^32 limbs
+ * least significant first without leading zero limbs, zero has no limbs */
+typedef struct {
+  int sign;
+  int count;
+  uint32_t *limb;
+} lbig;
+
 struct lval {
   int type;
 
   // Basics
   long num;
+  lbig big;
+  double dbl;
   char *err;
   char *sym;
   char *str;
@@ -76,6 +133,10 @@ struct lval {
   // Expression
   int count;
   lval **cell;
+
+  // Packed vector, count elements
+  int64_t *i64;
+  double *f64;
 };
 
 struct lenv {
@@ -85,12 +146,75 @@ struct lenv {
   lval **vals;
 };
 
+/* the prelude as static lvals, generated with
+ *   lispyc --emit-c prelude_baked.c prelude.lispy */
+#ifdef LISPY_BAKED_PRELUDE
+#include "prelude_baked.c"
+/* set once the baked prelude has been evaluated */
+static int lbaked_prelude_done;
+#endif
+
+/* a list the reader has opened but not yet closed, its elements are
+ * the reader's items from first on */
+typedef struct {
+  lval *list;
+  int first;
+  long row;
+  long col;
+} lreader_frame;
+
+/* reader state over a buffer of source text, row and line (the offset
+ * the current row starts at) are kept for error positions. When reading
+ * from a file the buffer only holds a window of it, refilled as the
+ * reader moves on, base being where in the file the window starts. An
+ * incremental reader is fed its text a line at a time and keeps a form
+ * left open at the end of the text for the next line, str_scan being
+ * how far into an open string it got. */
+typedef struct {
+  const char *filename;
+  const char *s;
+  long len;
+  long pos;
+  long row;
+  long line;
+
+  FILE *f;
+  char *buf;
+  long buf_slots;
+  long base;
+
+  lreader_frame *frames;
+  int frames_num;
+  int frames_slots;
+
+  lval **items;
+  int items_num;
+  int items_slots;
+
+  int incremental;
+  long str_scan;
+} lreader;
+
+/* contents of a whole file, mapped read-only where the platform allows */
+typedef struct {
+  char *data;
+  long len;
+  int mapped;
+} lfile;
+
+int lfile_open(lfile *f, const char *filename);
+void lfile_close(lfile *f);
+
 char *ltype_name(int t) {
   switch (t) {
   case LVAL_FUN:
     return "Function";
   case LVAL_NUM:
     return "Number";
+  case LVAL_BIGNUM:
+    return "Bignum";
+  case LVAL_DBL:
+    return "Double";
   case LVAL_ERR:
     return "Error";
   case LVAL_SYM:
@@ -101,6 +225,10 @@ char *ltype_name(int t) {
     return "S-Expression";
   case LVAL_QEXPR:
     return "Q-Expression";
+  case LVAL_I64VEC:
+    return "I64 Vector";
+  case LVAL_F64VEC:
+    return "F64 Vector";
   default:
     return "Unknown";
   }
@@ -109,26 +237,66 @@ char *ltype_name(int t) {
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
 lval *lval_sym(char *s);
-lval *lval_read_str(mpc_ast_t* t);
+lval *lval_sym_n(const char *s, long len);
+lval *lval_read_str(const char *s, long len);
 lval *lval_err(char *fmt, ...);
 lval *lval_num(long x);
+lval *lval_dbl(double x);
+lval *lval_i64vec(size_t n);
+lval *lval_f64vec(size_t n);
+lval *lval_bignum(lbig b);
+lval *lval_read_big(char *s);
+lbig lbig_copy(lbig x);
+int lbig_cmp(lbig x, lbig y);
+double lbig_to_dbl(lbig b);
+int lval_is_number(lval *v);
+double lval_to_dbl(lval *v);
 lval *lval_str(char *s);
 lval *lval_fun(lbuiltin func);
 lval *lval_lambda(lval *formals, lval *body);
 
-int number_of_nodes(mpc_ast_t *t);
-lval *eval_op(lval *x, char *op, lval *y);
-lval *eval(mpc_ast_t *t);
-lval *lval_read_num(mpc_ast_t *t);
-lval *lval_read(mpc_ast_t *t);
+void lreader_init(lreader *r, const char *filename, const char *s, long len);
+void lreader_init_file(lreader *r, const char *filename, FILE *f);
+void lreader_init_window(lreader *r, const char *filename, FILE *f,
+                         long slots);
+void lreader_init_incremental(lreader *r, const char *filename);
+void lreader_free(lreader *r);
+lval *lval_read_num(const char *s, long len, int is_dbl);
+lval *lval_read(lreader *r);
+lval *lval_read_all(lreader *r);
+lval *lval_read_line(lreader *r, const char *s, long len);
+lval *lcache_eval(lenv *e, lval *forms, const char *filename, FILE *f,
+                  long size);
+lval *limage_save(lenv *e, const char *path);
+void lload_files(lenv *e, char **filenames, int count);
+int lload_cpus(void);
+int lsplit_eval(lenv *e, const char *filename, const char *s, long len,
+                int threads, lval **err);
+lenv *limage_load(const char *path);
+lval *lbake_file(const char *filename, const char *path);
+void lbaked_prelude_eval(lenv *e);
+int lbaked_prelude_loaded(uint64_t hash, long len);
+int lbaked_prelude_named(const char *path);
+const char *lbuiltin_name(lbuiltin func);
+lbuiltin lbuiltin_find(const char *name);
+long lfile_size(FILE *f);
+void lfile_stamp(FILE *f, long *size, long *mtime);
 lval *lval_add(lval *v, lval *x);
+void lvec_kernels_init(void);
+int lsimd_level(void);
+void lscan_kernels_init(void);
 lval *lval_copy(lval *v);
-void lval_expr_print(lenv *e, lval *v, char open, char close);
+long lval_show(lval *v, char *o);
+long lval_show_big(lval *v, char *o);
+long lval_show_dbl(double d, char *o);
+void lout_byte(int c);
+void lout_flush(void);
+void lout_done(void);
 void lval_del(lval *v);
 lval *lval_pop(lval *v, int i);
 
 lval *builtin(lenv *e, lval *a, char *func);
-lval *builtin_op(lenv *e, lval *a, char *op);
+lval *builtin_op(lenv *e, lval *a, int op);
 lval *builtin_head(lenv *e, lval *a);
 lval *builtin_tail(lenv *e, lval *a);
 lval *builtin_list(lenv *e, lval *a);
@@ -138,19 +306,33 @@ lval *builtin_add(lenv *e, lval *a);
 lval *builtin_sub(lenv *e, lval *a);
 lval *builtin_mul(lenv *e, lval *a);
 lval *builtin_div(lenv *e, lval *a);
+lval *builtin_sum(lenv *e, lval *a);
+lval *builtin_product(lenv *e, lval *a);
 lval *builtin_def(lenv *e, lval *a);
 lval *builtin_put(lenv *e, lval *a);
 lval *builtin_var(lenv *e, lval *a, char *func);
 lval *builtin_lambda(lenv *e, lval *a);
-lval *builtin_ord(lenv *e, lval *a, char *op);
+lval *builtin_ord(lenv *e, lval *a, int op);
 lval *builtin_gt(lenv *e, lval *a);
 lval *builtin_lt(lenv *e, lval *a);
 lval *builtin_ge(lenv *e, lval *a);
 lval *builtin_le(lenv *e, lval *a);
-lval *builtin_cmp(lenv *e, lval *a, char *op);
 lval *builtin_eq(lenv *e, lval *a);
 lval *builtin_ne(lenv *e, lval *a);
 lval *builtin_if(lenv *e, lval *a);
+lval *builtin_i64vec(lenv *e, lval *a);
+lval *builtin_f64vec(lenv *e, lval *a);
+lval *builtin_vec_list(lenv *e, lval *a);
+lval *builtin_vec_len(lenv *e, lval *a);
+lval *builtin_vec_add(lenv *e, lval *a);
+lval *builtin_vec_sub(lenv *e, lval *a);
+lval *builtin_vec_mul(lenv *e, lval *a);
+lval *builtin_vec_div(lenv *e, lval *a);
+lval *builtin_vec_sum(lenv *e, lval *a);
+lval *builtin_vec_product(lenv *e, lval *a);
+lval *builtin_vec_min(lenv *e, lval *a);
+lval *builtin_vec_max(lenv *e, lval *a);
+lval *builtin_vec_dot(lenv *e, lval *a);
 
 lval *lval_join(lenv *e, lval *x, lval *y);
 lval *lval_take(lenv *e, lval *v, int i);
@@ -161,15 +343,6 @@ int lval_eq(lval *x, lval *y);
 void lval_print(lenv *e, lval *v);
 void lval_println(lenv *e, lval *v);
 
-mpc_parser_t *Number;
-mpc_parser_t *Symbol;
-mpc_parser_t *String;
-mpc_parser_t *Comment;
-mpc_parser_t *Sexpr;
-mpc_parser_t *Qexpr;
-mpc_parser_t *Expr;
-mpc_parser_t *Lispy;
-
 
 
 lenv *lenv_new(void) {
@@ -253,52 +426,243 @@ lval* builtin_load(lenv* e, lval* a) {
   LASSERT_ARG_COUNT(a, "load", 1);
   LASSERT_TYPE(a, "load", 0, LVAL_STR);
 
-  /*   parse file given by string name */
-  mpc_result_t r;
-  if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
-    /*     read contents */
-    lval* expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
-
-    /*     evaluate each expression */
-    while (expr->count) {
-      lval* x = lval_eval(e, lval_pop(expr, 0));
-      /*       if evaluation leads to error print it */
-      if (x->type == LVAL_ERR) { lval_println(e, x); }
+  /*   open file given by string name */
+  FILE* f = fopen(a->cell[0]->str, "rb");
+#ifdef LISPY_BAKED_PRELUDE
+  /*   the prelude is compiled in when its file isn't around */
+  if (!f && lbaked_prelude_named(a->cell[0]->str)) {
+    if (!lbaked_prelude_done) {
+      lbaked_prelude_eval(e);
+    }
+    lval_del(a);
+    return lval_sexpr();
+  }
+#endif
+  if (!f) {
+    lval* err = lval_err("Could not load library %s: Unable to open file!",
+                         a->cell[0]->str);
+    lval_del(a);
+    return err;
+  }
+
+  /*   files of a moderate size are read whole through the cache */
+  long size = lfile_size(f);
+  if (size >= 0 && size <= LCACHE_MAX_SOURCE) {
+    lval* x = lcache_eval(e, NULL, a->cell[0]->str, f, size);
+    fclose(f);
+    if (x) {
+      lval* err = lval_err("Could not load library %s", x->err);
       lval_del(x);
+      lval_del(a);
+      return err;
+    }
+    lval_del(a);
+    return lval_sexpr();
+  }
+
+#ifdef LISPY_THREADS
+  /*   bigger ones are read on every core when they can be mapped, cut
+   *   into chunks between top level forms */
+  int threads = lload_cpus();
+  lfile file;
+  if (threads > 1 && size > 0 && lfile_open(&file, a->cell[0]->str)) {
+    lval* x = NULL;
+    int done = file.mapped && lsplit_eval(e, a->cell[0]->str, file.data,
+                                          file.len, threads, &x);
+    lfile_close(&file);
+    if (done) {
+      fclose(f);
+      if (x) {
+        lval* err = lval_err("Could not load library %s", x->err);
+        lval_del(x);
+        lval_del(a);
+        return err;
+      }
+      lval_del(a);
+      return lval_sexpr();
+    }
+  }
+#endif
+
+  /*   otherwise read and evaluate one expression at a time so only the
+   *   current form is held in memory */
+  lreader r;
+  lreader_init_file(&r, a->cell[0]->str, f);
+  lval* expr;
+  while ((expr = lval_read(&r))) {
+    if (expr->type == LVAL_ERR) {
+      /*     create new error message using the syntax error */
+      lval* err = lval_err("Could not load library %s", expr->err);
+      lval_del(expr);
+      lreader_free(&r);
+      fclose(f);
+      lval_del(a);
+      return err;
     }
 
-    /*     delete expressions and arguments */
-    lval_del(expr);
+    lval* x = lval_eval(e, expr);
+    /*     if evaluation leads to error print it */
+    if (x->type == LVAL_ERR) { lval_println(e, x); }
+    lval_del(x);
+  }
+
+  lreader_free(&r);
+  fclose(f);
+  lval_del(a);
+
+  return lval_sexpr();
+}
+
+lval* builtin_read_file(lenv* e, lval* a) {
+  LASSERT_ARG_COUNT(a, "read-file", 1);
+  LASSERT_TYPE(a, "read-file", 0, LVAL_STR);
+
+  /*   map the file and read every form in it as data, evaluating none */
+  lfile file;
+  if (!lfile_open(&file, a->cell[0]->str)) {
+    lval* err = lval_err("Could not read file %s: Unable to open file!",
+                         a->cell[0]->str);
     lval_del(a);
+    return err;
+  }
+  lreader r;
+  lreader_init(&r, a->cell[0]->str, file.data, file.len);
+  lval* x = lval_read_all(&r);
+  lreader_free(&r);
+  lfile_close(&file);
 
-    return lval_sexpr();
-  } else {
-    /*     get parse error as string */
-    char* err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
+  if (x->type == LVAL_ERR) {
+    lval* err = lval_err("Could not read file %s", x->err);
+    lval_del(x);
+    lval_del(a);
+    return err;
+  }
+  x->type = LVAL_QEXPR;
+  lval_del(a);
+  return x;
+}
 
-    /*     create new error message using it */
-    lval* err = lval_err("Could not load library %s", err_msg);
-    free(err_msg);
+/* read-forms reads one form at a time. (read-forms "file") gives
+ * {form rest} where rest is {read-forms "file" {offset row col size mtime}},
+ * which evaluates to the next pair, or {} once the file has no more forms.
+ * Each step reads the file from the offset on, only as far as the form
+ * goes, and fails if the file's size or modification time changed */
+#define LREAD_FORMS_WINDOW 4096
+
+lval* builtin_read_forms(lenv* e, lval* a) {
+  LASSERT(a, a->count == 1 || a->count == 2,
+          "Function 'read-forms' passed incorrect number of arguments! "
+          "got %i, expected 1 or 2",
+          a->count);
+  LASSERT_TYPE(a, "read-forms", 0, LVAL_STR);
+  long state[5] = {0, 0, 0, 0, 0};
+  if (a->count == 2) {
+    LASSERT_TYPE(a, "read-forms", 1, LVAL_QEXPR);
+    lval* q = a->cell[1];
+    LASSERT(a, q->count == 5,
+            "Function 'read-forms' passed a bad position! "
+            "got %i numbers, expected 5",
+            q->count);
+    for (int i = 0; i < 5; i++) {
+      LASSERT(a, q->cell[i]->type == LVAL_NUM,
+              "Function 'read-forms' passed a bad position! "
+              "Got %s, Expected %s.",
+              ltype_name(q->cell[i]->type), ltype_name(LVAL_NUM));
+      state[i] = q->cell[i]->num;
+    }
+  }
+
+  /*   pipes can't be read again from the offset */
+  char* name = a->cell[0]->str;
+  LASSERT(a, a->count == 1 || state[3] >= 0,
+          "Could not read file %s: can't seek to the offset!", name);
+  FILE* f = fopen(name, "rb");
+  if (!f) {
+    lval* err = lval_err("Could not read file %s: Unable to open file!", name);
+    lval_del(a);
+    return err;
+  }
+  long size, mtime;
+  lfile_stamp(f, &size, &mtime);
+  char* problem = NULL;
+  if (a->count == 2 && (size != state[3] || mtime != state[4])) {
+    problem = "file changed while being read!";
+  } else if (state[0] < 0 || (size > 0 && state[0] > size)) {
+    problem = "offset out of range!";
+  } else if (state[0] > 0 && fseek(f, state[0], SEEK_SET) != 0) {
+    problem = "can't seek to the offset!";
+  }
+  if (problem) {
+    fclose(f);
+    lval* err = lval_err("Could not read file %s: %s", name, problem);
     lval_del(a);
+    return err;
+  }
 
+  /*   the reader picks up at the row and column the last form ended on */
+  lreader r;
+  lreader_init_window(&r, name, f, LREAD_FORMS_WINDOW);
+  r.row = state[1];
+  r.line = -state[2];
+  lval* x = lval_read(&r);
+  long next = state[0] + r.base + r.pos;
+  long row = r.row, col = r.pos - r.line;
+  lreader_free(&r);
+  fclose(f);
+
+  if (x && x->type == LVAL_ERR) {
+    lval* err = lval_err("Could not read file %s", x->err);
+    lval_del(x);
+    lval_del(a);
     return err;
   }
+  lval* v = lval_qexpr();
+  if (x) {
+    lval* at = lval_qexpr();
+    lval_add(at, lval_num(next));
+    lval_add(at, lval_num(row));
+    lval_add(at, lval_num(col));
+    lval_add(at, lval_num(size));
+    lval_add(at, lval_num(mtime));
+    lval* rest = lval_qexpr();
+    lval_add(rest, lval_sym("read-forms"));
+    lval_add(rest, lval_str(name));
+    lval_add(rest, at);
+    lval_add(v, x);
+    lval_add(v, rest);
+  }
+  lval_del(a);
+  return v;
 }
 
 lval* builtin_print(lenv* e, lval* a) {
   /*   print each argument followed by a space */
   for (int i = 0; i < a->count; i++) {
-    lval_print(e, a->cell[i]); putchar(' ');
+    lval_print(e, a->cell[i]); lout_byte(' ');
   }
 
-  putchar('\n');
+  lout_byte('\n');
+  lout_done();
   lval_del(a);
 
   return lval_sexpr();
 }
 
+lval* builtin_show(lenv* e, lval* a) {
+  LASSERT_ARG_COUNT(a, "show", 1);
+
+  /*   the printed form as a string, written into one allocation */
+  long n = lval_show(a->cell[0], NULL);
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_STR;
+  v->str = malloc(n + 1);
+  lval_show(a->cell[0], v->str);
+  v->str[n] = '\0';
+
+  lval_del(a);
+  return v;
+}
+
 lval* builtin_error(lenv* e, lval* a) {
   LASSERT_ARG_COUNT(a, "error", 1);
   LASSERT_TYPE(a, "error", 0, LVAL_STR);
@@ -317,334 +681,2601 @@ void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
   lval_del(v);
 }
 
-void lenv_add_builtins(lenv *e) {
-  lenv_add_builtin(e, "load", builtin_load);
-  lenv_add_builtin(e, "print", builtin_print);
-  lenv_add_builtin(e, "error", builtin_print);
-
-
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
-
-  lenv_add_builtin(e, "def", builtin_def);
-  lenv_add_builtin(e, "\\", builtin_lambda);
-  lenv_add_builtin(e, "=", builtin_put);
-
+/* every builtin by the name it is bound to, images rebind builtins by
+ * looking their names up here */
+static struct {
+  char *name;
+  lbuiltin func;
+} lbuiltins[] = {
+    {"load", builtin_load},
+    {"read-file", builtin_read_file},
+    {"read-forms", builtin_read_forms},
+    {"print", builtin_print},
+    {"show", builtin_show},
+    {"to-string", builtin_show},
+    {"error", builtin_print},
+
+    {"list", builtin_list},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"eval", builtin_eval},
+    {"join", builtin_join},
+
+    {"def", builtin_def},
+    {"\\", builtin_lambda},
+    {"=", builtin_put},
+
+    {"+", builtin_add},
+    {"-", builtin_sub},
+    {"*", builtin_mul},
+    {"/", builtin_div},
+    {"sum", builtin_sum},
+    {"product", builtin_product},
+
+    {">", builtin_gt},
+    {">=", builtin_ge},
+    {"<", builtin_lt},
+    {"<=", builtin_le},
+
+    {"!=", builtin_ne},
+    {"==", builtin_eq},
+    {"if", builtin_if},
+
+    {"i64vec", builtin_i64vec},
+    {"f64vec", builtin_f64vec},
+    {"vec->list", builtin_vec_list},
+    {"vec-len", builtin_vec_len},
+    {"vec+", builtin_vec_add},
+    {"vec-", builtin_vec_sub},
+    {"vec*", builtin_vec_mul},
+    {"vec/", builtin_vec_div},
+    {"vec-sum", builtin_vec_sum},
+    {"vec-product", builtin_vec_product},
+    {"vec-min", builtin_vec_min},
+    {"vec-max", builtin_vec_max},
+    {"vec-dot", builtin_vec_dot},
+    {NULL, NULL},
+};
 
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
+void lenv_add_builtins(lenv *e) {
+  for (int i = 0; lbuiltins[i].name; i++) {
+    lenv_add_builtin(e, lbuiltins[i].name, lbuiltins[i].func);
+  }
+}
 
-  lenv_add_builtin(e, ">", builtin_gt);
-  lenv_add_builtin(e, ">=", builtin_ge);
-  lenv_add_builtin(e, "<", builtin_lt);
-  lenv_add_builtin(e, "<=", builtin_le);
+/* the first name a builtin is bound to */
+const char *lbuiltin_name(lbuiltin func) {
+  for (int i = 0; lbuiltins[i].name; i++) {
+    if (lbuiltins[i].func == func) {
+      return lbuiltins[i].name;
+    }
+  }
+  return "";
+}
 
-  lenv_add_builtin(e, "!=", builtin_ne);
-  lenv_add_builtin(e, "==", builtin_eq);
-  lenv_add_builtin(e, "if", builtin_if);
+lbuiltin lbuiltin_find(const char *name) {
+  for (int i = 0; lbuiltins[i].name; i++) {
+    if (strcmp(lbuiltins[i].name, name) == 0) {
+      return lbuiltins[i].func;
+    }
+  }
+  return NULL;
 }
 
 
 int main(int argc, char **argv) {
-  Number = mpc_new("number");
-  Symbol = mpc_new("symbol");
-  String = mpc_new("string");
-  Comment = mpc_new("comment");
-  Sexpr = mpc_new("sexpr");
-  Qexpr = mpc_new("qexpr");
-  Expr = mpc_new("expr");
-  Lispy = mpc_new("lispy");
-
-  mpca_lang(MPCA_LANG_DEFAULT,
-            "                                                 \
-      number     : /-?[0-9]+/ ;                       \
-      symbol     : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; \
-      string     : /\"(\\\\.|[^\"])*\"/ ; \
-      comment    : /;[^\\r\\n]*/ ; \
-      sexpr      : '(' <expr>* ')' ;             \
-      qexpr      : '{' <expr>* '}' ;             \
-      expr       : <number> | <symbol> | <string> \
-                 | <comment> | <sexpr> | <qexpr>; \
-      lispy      : /^/ <expr>* /$/ ;    \
-    ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  lvec_kernels_init();
+  lscan_kernels_init();
+
+  /* pull out the options, leaving the files to load in argv */
+  char *image = NULL;
+  char *save_image = NULL;
+  char *emit_c = NULL;
+  int files = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      image = argv[++i];
+    } else if (strcmp(argv[i], "--save-image") == 0 && i + 1 < argc) {
+      save_image = argv[++i];
+    } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+      emit_c = argv[++i];
+    } else {
+      argv[files++] = argv[i];
+    }
+  }
+  argc = files;
+
+  /* build step, write the forms of one file out as C */
+  if (emit_c) {
+    if (argc != 2) {
+      fprintf(stderr, "usage: lispyc --emit-c out.c file.lispy\n");
+      return 1;
+    }
+    lval *x = lbake_file(argv[1], emit_c);
+    int failed = x->type == LVAL_ERR;
+    if (failed) {
+      fprintf(stderr, "Error: %s\n", x->err);
+    }
+    lval_del(x);
+    return failed;
+  }
 
+  atexit(lout_flush);
   puts("Lispy Version 0.0.0.0.1");
   puts("Press Ctrl+c to Exit\n");
 
-  lenv *e = lenv_new();
-  lenv_add_builtins(e);
-
-  if (argc >= 2) {
-    for (int i = 1; i < argc; i++) {
-      lval *args = lval_add(lval_sexpr(), lval_str(argv[i]));
+  lenv *e;
+  if (image) {
+    e = limage_load(image);
+    if (!e) {
+      fprintf(stderr, "Error: Could not load image %s\n", image);
+      return 1;
+    }
+  } else {
+    e = lenv_new();
+    lenv_add_builtins(e);
+#ifdef LISPY_BAKED_PRELUDE
+    lbaked_prelude_eval(e);
+#endif
+  }
 
-      lval* x = builtin_load(e, args);
+  if (argc >= 2 || save_image) {
+    lload_files(e, argv + 1, argc - 1);
 
+    if (save_image) {
+      lval *x = limage_save(e, save_image);
       if (x->type == LVAL_ERR) {
         lval_println(e, x);
       }
       lval_del(x);
     }
   } else {
+    /* lines are read into one reader so an expression can run over
+     * several of them, it is evaluated once its lists are all closed */
+    lreader r;
+    lreader_init_incremental(&r, "<stdin>");
+    const char *prompt = "lispy> ";
     while (1) {
       /* fgets don't let you edit the line by navigating with arrow keys
        * e.g. */
       /* fgets(input, INPUT_BUFFER, stdin); */
 
-      char *input = readline("lispy> ");
+      lout_flush();
+      char *input = readline(prompt);
+      if (!input) {
+        break;
+      }
 
       add_history(input);
 
-      mpc_result_t r;
-      if (mpc_parse("<stdin>", input, Lispy, &r)) {
-        /* On success evaluate the AST */
-        /* lval* result = eval(r.output); */
-        lval *x = lval_eval(e, lval_read(r.output));
-        lval_println(e, x);
-        lval_del(x);
-        mpc_ast_delete(r.output);
-      } else {
-        /* Otherwise Print the Error */
-        mpc_err_print(r.error);
-        mpc_err_delete(r.error);
-      }
+      lval *x = lval_read_line(&r, input, strlen(input));
       free(input);
+      if (!x) {
+        prompt = "  ...> ";
+        continue;
+      }
+      prompt = "lispy> ";
+      if (x->type != LVAL_ERR) {
+        x = lval_eval(e, x);
+      }
+      lval_println(e, x);
+      lval_del(x);
     }
+    lreader_free(&r);
   }
   lenv_del(e);
 
-  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
   return 0;
 }
 
-lval *eval(mpc_ast_t *t) {
+/*
+ * Scanning
+ *
+ * The reader finds the ends of whitespace runs, comments and string
+ * bodies with these kernels instead of looking at one byte at a time.
+ * Each takes a range [i, n) of a buffer and returns the index where the
+ * run stops, or n when it reaches the end of what is in memory. Like
+ * the vector kernels they come in scalar, SSE2 and AVX2 flavours.
+ */
+
+typedef struct {
+  /* first byte that is not whitespace, rows is bumped for every newline
+   * passed and nl set to the index of the last one */
+  long (*space)(const char *s, long i, long n, long *rows, long *nl);
+  /* first byte equal to a, b or c */
+  long (*find)(const char *s, long i, long n, char a, char b, char c);
+} lscan_kernels;
+
+static int lscan_is_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-  /* If tagged as number return it directly. */
-  if (strstr(t->tag, "number")) {
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+static long lscan_space_scalar(const char *s, long i, long n, long *rows,
+                               long *nl) {
+  for (; i < n && lscan_is_space(s[i]); i++) {
+    if (s[i] == '\n') {
+      (*rows)++;
+      *nl = i;
+    }
   }
+  return i;
+}
 
-  /* The operator is always second child. */
-  char *op = t->children[1]->contents;
-
-  /* We store the third child in `x` */
-  lval *x = eval(t->children[2]);
-
-  /* Iterate the remaining children and combining. */
-  int i = 3;
-  while (strstr(t->children[i]->tag, "expr")) {
-    x = eval_op(x, op, eval(t->children[i]));
+static long lscan_find_scalar(const char *s, long i, long n, char a, char b,
+                              char c) {
+  while (i < n && s[i] != a && s[i] != b && s[i] != c) {
     i++;
   }
-
-  return x;
+  return i;
 }
 
-lval *eval_op(lval *x, char *op, lval *y) {
-  if (x->type == LVAL_ERR) {
-    return x;
-  }
-  if (y->type == LVAL_ERR) {
-    return y;
+static const lscan_kernels lscan_scalar = {lscan_space_scalar,
+                                           lscan_find_scalar};
+
+#ifdef LVEC_X86
+
+/* whitespace is ' ' and '\t' to '\r', the lanes outside the run are
+ * masked off the newlines before they are counted */
+#define LSCAN_SPACE(name, attr, vec, width, load, set1, eq, gt, lt, vand, vor,  \
+                    movemask)                                                 \
+  attr static long name(const char *s, long i, long n, long *rows,           \
+                        long *nl) {                                          \
+    const vec sp = set1(' '), lo = set1('\t' - 1), hi = set1('\r' + 1);      \
+    const vec lf = set1('\n');                                               \
+    for (; i + width <= n; i += width) {                                     \
+      vec x = load((const vec *)(s + i));                                    \
+      vec ws = vor(eq(x, sp), vand(gt(x, lo), lt(x, hi)));                     \
+      uint32_t stop = ~(uint32_t)movemask(ws);                               \
+      uint32_t lines = (uint32_t)movemask(eq(x, lf));                        \
+      if (width < 32) {                                                      \
+        stop &= (1u << (width & 31)) - 1;                                    \
+      }                                                                      \
+      if (stop) {                                                            \
+        lines &= (1u << __builtin_ctz(stop)) - 1;                            \
+      }                                                                      \
+      if (lines) {                                                           \
+        *rows += __builtin_popcount(lines);                                  \
+        *nl = i + 31 - __builtin_clz(lines);                                 \
+      }                                                                      \
+      if (stop) {                                                            \
+        return i + __builtin_ctz(stop);                                      \
+      }                                                                      \
+    }                                                                        \
+    return lscan_space_scalar(s, i, n, rows, nl);                            \
   }
 
-  if (strcmp(op, "+") == 0) {
-    return lval_num(x->num + y->num);
+#define LSCAN_FIND(name, attr, vec, width, load, set1, eq, vor, movemask)      \
+  attr static long name(const char *s, long i, long n, char a, char b,       \
+                        char c) {                                            \
+    const vec va = set1(a), vb = set1(b), vc = set1(c);                      \
+    for (; i + width <= n; i += width) {                                     \
+      vec x = load((const vec *)(s + i));                                    \
+      uint32_t hit = (uint32_t)movemask(                                     \
+          vor(vor(eq(x, va), eq(x, vb)), eq(x, vc)));                          \
+      if (hit) {                                                             \
+        return i + __builtin_ctz(hit);                                       \
+      }                                                                      \
+    }                                                                        \
+    return lscan_find_scalar(s, i, n, a, b, c);                              \
   }
-  if (strcmp(op, "-") == 0) {
-    return lval_num(x->num - y->num);
-  }
-  if (strcmp(op, "*") == 0) {
-    return lval_num(x->num * y->num);
+
+LSCAN_SPACE(lscan_space_sse2, LVEC_SSE2, __m128i, 16, _mm_loadu_si128,
+            _mm_set1_epi8, _mm_cmpeq_epi8, _mm_cmpgt_epi8, _mm_cmplt_epi8,
+            _mm_and_si128, _mm_or_si128, _mm_movemask_epi8)
+LSCAN_FIND(lscan_find_sse2, LVEC_SSE2, __m128i, 16, _mm_loadu_si128,
+           _mm_set1_epi8, _mm_cmpeq_epi8, _mm_or_si128, _mm_movemask_epi8)
+
+static const lscan_kernels lscan_sse2 = {lscan_space_sse2, lscan_find_sse2};
+
+/* AVX2 has no byte less-than, swap the operands of greater-than */
+#define lscan_cmplt_avx2(x, y) _mm256_cmpgt_epi8(y, x)
+
+LSCAN_SPACE(lscan_space_avx2, LVEC_AVX2, __m256i, 32, _mm256_loadu_si256,
+            _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_cmpgt_epi8,
+            lscan_cmplt_avx2, _mm256_and_si256, _mm256_or_si256,
+            _mm256_movemask_epi8)
+LSCAN_FIND(lscan_find_avx2, LVEC_AVX2, __m256i, 32, _mm256_loadu_si256,
+           _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_or_si256,
+           _mm256_movemask_epi8)
+
+static const lscan_kernels lscan_avx2 = {lscan_space_avx2, lscan_find_avx2};
+
+#endif
+
+static const lscan_kernels *lscan_picked = &lscan_scalar;
+
+/* pick the widest kernels the CPU supports, once at startup before any
+ * reader thread starts */
+#ifdef LVEC_X86
+/* the widest kernels the CPU runs, 0 scalar, 1 SSE2 or 2 AVX2, capped by
+ * $LISPY_SIMD (scalar, sse2 or avx2) so every flavour can be tested */
+int lsimd_level(void) {
+  __builtin_cpu_init();
+  int level = __builtin_cpu_supports("avx2")   ? 2
+              : __builtin_cpu_supports("sse2") ? 1
+                                               : 0;
+  const char *want = getenv("LISPY_SIMD");
+  if (want && strcmp(want, "scalar") == 0) {
+    level = 0;
+  } else if (want && strcmp(want, "sse2") == 0 && level > 1) {
+    level = 1;
   }
-  if (strcmp(op, "/") == 0) {
-    return y->num == 0 ? lval_err(LERR_DIV_ZERO) : lval_num(x->num / y->num);
+  return level;
+}
+#endif
+
+void lscan_kernels_init(void) {
+#ifdef LVEC_X86
+  int level = lsimd_level();
+  if (level == 2) {
+    lscan_picked = &lscan_avx2;
+  } else if (level == 1) {
+    lscan_picked = &lscan_sse2;
   }
-  return lval_err("invalid operator");
+#endif
 }
 
-lval *lval_read_num(mpc_ast_t *t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+static const lscan_kernels *lscan_kernels_get(void) { return lscan_picked; }
+
+/*
+ * Reader
+ *
+ * Turns source text into lvals in a single pass without backtracking.
+ * Tokens are recognised like the old mpc grammar did: a number is tried
+ * before a symbol, strings may contain escaped quotes and comments run
+ * to the end of the line. Lists are built on an explicit stack, and each
+ * list gets its cell array in one allocation once it is closed. Lists
+ * may nest LREADER_MAX_DEPTH deep, as copying, printing, caching and
+ * freeing values still recurse and deeper ones would run out of stack.
+ *
+ * A file reader keeps a window of the file in memory. Everything before
+ * the token being read is dropped when the window is refilled, so only
+ * the form being read and one chunk of text are held at a time.
+ */
+
+#define LREADER_CHUNK 65536
+#define LREADER_MAX_DEPTH 10000
+
+void lreader_init(lreader *r, const char *filename, const char *s, long len) {
+  r->filename = filename;
+  r->s = s;
+  r->len = len;
+  r->pos = 0;
+  r->row = 0;
+  r->line = 0;
+  r->f = NULL;
+  r->buf = NULL;
+  r->buf_slots = 0;
+  r->base = 0;
+  r->frames = NULL;
+  r->frames_num = 0;
+  r->frames_slots = 0;
+  r->items = NULL;
+  r->items_num = 0;
+  r->items_slots = 0;
+  r->incremental = 0;
+  r->str_scan = 0;
 }
 
-lval *lval_read(mpc_ast_t *t) {
-  if (strstr(t->tag, "number")) {
-    return lval_read_num(t);
-  }
-  if (strstr(t->tag, "symbol")) {
-    return lval_sym(t->contents);
+void lreader_init_file(lreader *r, const char *filename, FILE *f) {
+  lreader_init_window(r, filename, f, LREADER_CHUNK);
+}
+
+/* a file reader starting with a window of slots bytes, which is also how
+ * much it asks the file for at a time */
+void lreader_init_window(lreader *r, const char *filename, FILE *f,
+                         long slots) {
+  lreader_init(r, filename, NULL, 0);
+  r->f = f;
+  r->buf_slots = slots;
+  r->buf = malloc(r->buf_slots);
+  r->s = r->buf;
+}
+
+void lreader_init_incremental(lreader *r, const char *filename) {
+  lreader_init(r, filename, NULL, 0);
+  r->incremental = 1;
+}
+
+/* add a line of text to what is left of an incremental reader's input */
+static void lreader_feed(lreader *r, const char *s, long len) {
+  /* drop the text read already once it is most of the buffer, so a long
+   * open form isn't moved again for every line */
+  if (r->pos > 0 && r->pos >= r->len - r->pos) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->line -= r->pos;
+    r->base += r->pos;
+    r->pos = 0;
   }
-  if (strstr(t->tag, "string")) {
-    return lval_read_str(t);
+  if (r->len + len + 1 > r->buf_slots) {
+    r->buf_slots = r->buf_slots * 2 > r->len + len + 1 ? r->buf_slots * 2
+                                                       : r->len + len + 1;
+    r->buf = realloc(r->buf, r->buf_slots);
+    r->s = r->buf;
   }
+  memcpy(r->buf + r->len, s, len);
+  r->len += len;
+  r->buf[r->len++] = '\n';
+}
 
-  lval *x = NULL;
-  if (strcmp(t->tag, ">") == 0) {
-    x = lval_sexpr();
-  }
-  if (strstr(t->tag, "sexpr")) {
-    x = lval_sexpr();
+/* drop the lists and items of a form that was only partly read */
+static void lreader_reset(lreader *r) {
+  for (int i = 0; i < r->frames_num; i++) {
+    lval_del(r->frames[i].list);
   }
-  if (strstr(t->tag, "qexpr")) {
-    x = lval_qexpr();
+  for (int i = 0; i < r->items_num; i++) {
+    lval_del(r->items[i]);
   }
+  r->frames_num = 0;
+  r->items_num = 0;
+  r->str_scan = 0;
+}
 
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, ")") == 0) {
-      continue;
+void lreader_free(lreader *r) {
+  lreader_reset(r);
+  free(r->frames);
+  free(r->items);
+  free(r->buf);
+  r->frames = NULL;
+  r->frames_slots = 0;
+  r->items = NULL;
+  r->items_slots = 0;
+  r->buf = NULL;
+  r->buf_slots = 0;
+}
+
+/* make sure the byte i past the cursor is in the buffer, reading more of
+ * the file if there is one, 0 once the input is used up */
+static int lreader_more(lreader *r, long i) {
+  if (!r->f) {
+    return 0;
+  }
+  while (r->pos + i >= r->len) {
+    /* slide the text from the cursor on to the front */
+    if (r->pos > 0) {
+      memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+      r->len -= r->pos;
+      r->line -= r->pos;
+      r->base += r->pos;
+      r->pos = 0;
     }
-    if (strcmp(t->children[i]->contents, "{") == 0) {
-      continue;
+    if (r->len == r->buf_slots) {
+      r->buf_slots *= 2;
+      r->buf = realloc(r->buf, r->buf_slots);
+      r->s = r->buf;
     }
-    if (strcmp(t->children[i]->contents, "}") == 0) {
-      continue;
+#ifdef LISPY_MMAP
+    /* take whatever is there so forms piped in are read as they arrive,
+     * showing what has been printed before waiting on standard input */
+    if (r->f == stdin) {
+      lout_flush();
     }
-    if (strcmp(t->children[i]->tag, "regex") == 0) {
-      continue;
+    ssize_t got;
+    do {
+      got = read(fileno(r->f), r->buf + r->len, r->buf_slots - r->len);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+      return 0;
     }
-    if (strstr(t->children[i]->tag, "comment")) {
-      continue;
+#else
+    size_t got = fread(r->buf + r->len, 1, r->buf_slots - r->len, r->f);
+    if (got == 0) {
+      return 0;
     }
-    x = lval_add(x, lval_read(t->children[i]));
+#endif
+    r->len += got;
   }
-  return x;
+  return 1;
 }
 
-lval *lval_copy(lval *v) {
-  lval *x = malloc(sizeof(lval));
-  x->type = v->type;
-
-  switch (v->type) {
-  /* copy functions and numbers directly */
-  case LVAL_FUN:
-    if (v->builtin) {
-      x->builtin = v->builtin;
-    } else {
-      x->builtin = NULL;
-      x->env = lenv_copy(v->env);
-      x->formals = lval_copy(v->formals);
-      x->body = lval_copy(v->body);
-    }
-    break;
-  case LVAL_NUM:
-    x->num = v->num;
-    break;
-
-  /* copy strings using malloc and strcpy */
-  case LVAL_ERR:
-    x->err = malloc(strlen(v->err) + 1);
-    strcpy(x->err, v->err);
-    break;
-  case LVAL_SYM:
-    x->sym = malloc(strlen(v->sym) + 1);
-    strcpy(x->sym, v->sym);
-    break;
-  case LVAL_STR:
-    x->str = malloc(strlen(v->str) + 1);
-    strcpy(x->str, v->str);
-    break;
-
-  /* copy lists by copying each sub-expression */
-  case LVAL_SEXPR:
-  case LVAL_QEXPR:
-    x->count = v->count;
-    x->cell = malloc(sizeof(lval *) * x->count);
-    for (int i = 0; i < x->count; i++) {
-      x->cell[i] = lval_copy(v->cell[i]);
-    }
-    break;
-  }
-  return x;
+/* is there a byte i past the cursor */
+static int lreader_has(lreader *r, long i) {
+  return r->pos + i < r->len || lreader_more(r, i);
 }
 
-lval *lval_add(lval *v, lval *x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-  v->cell[v->count - 1] = x;
-  return v;
+static int lreader_is_symbol(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') ||
+         (c != '\0' && strchr("_+-*/\\=<>!&", c) != NULL);
 }
 
-void lval_expr_print(lenv *e, lval *v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    lval_print(e, v->cell[i]);
+static int lreader_is_digit(char c) { return c >= '0' && c <= '9'; }
 
-    if (i != (v->count - 1)) {
-      putchar(' ');
-    }
+/* describe the character at the cursor the way mpc's errors do */
+static const char *lreader_received(lreader *r, char *buf) {
+  if (!lreader_has(r, 0)) {
+    return "end of input";
+  }
+  switch (r->s[r->pos]) {
+  case '\n':
+    return "newline";
+  case '\t':
+    return "tab";
+  case ' ':
+    return "space";
+  case '\r':
+    return "carriage return";
   }
-  putchar(close);
+  buf[0] = '\'';
+  buf[1] = r->s[r->pos];
+  buf[2] = '\'';
+  buf[3] = '\0';
+  return buf;
 }
 
-void lval_print_str(lval* v) {
-  // make a copy of the string
-  char* escaped = malloc(strlen(v->str) + 1);
-  strcpy(escaped, v->str);
+/* syntax error at the cursor, abandons everything read so far. Inside a
+ * list the error notes where the innermost list was opened */
+static lval *lreader_error(lreader *r, const char *expected) {
+  char buf[4];
+  char open[96] = "";
+  if (r->frames_num > 0) {
+    lreader_frame *f = &r->frames[r->frames_num - 1];
+    snprintf(open, sizeof(open), " ('%c' opened at %li:%li)",
+             f->list->type == LVAL_SEXPR ? '(' : '{', f->row + 1, f->col + 1);
+  }
+  long col = r->pos - r->line + 1;
+  lval *err = lval_err("%s:%li:%li: expected %s at %s%s", r->filename,
+                       r->row + 1, col, expected, lreader_received(r, buf),
+                       open);
+  lreader_reset(r);
+  return err;
+}
 
-  /*   pass it through the escape function */
-  escaped = mpcf_escape(escaped);
-  /*   print it between " characters  */
-  printf("\"%s\"", escaped);
-  free(escaped);
+/* error for a list opened LREADER_MAX_DEPTH deep */
+static lval *lreader_too_deep(lreader *r) {
+  lval *err = lval_err("%s:%li:%li: lists nested more than %i deep",
+                       r->filename, r->row + 1, r->pos - r->line + 1,
+                       LREADER_MAX_DEPTH);
+  lreader_reset(r);
+  return err;
 }
 
-void lval_print(lenv *e, lval *v) {
-  switch (v->type) {
-  case LVAL_NUM:
-    printf("%li", v->num);
-    break;
-  case LVAL_ERR:
-    printf("Error: %s", v->err);
-    break;
-  case LVAL_SYM:
-    printf("%s", v->sym);
-    break;
-  case LVAL_STR:
-    lval_print_str(v);
-    break;
-  case LVAL_SEXPR:
-    lval_expr_print(e, v, '(', ')');
-    break;
-  case LVAL_QEXPR:
-    lval_expr_print(e, v, '{', '}');
-    break;
-  case LVAL_FUN:
-    if (v->builtin) {
-      printf("<builtin>");
-    } else {
-      printf("(\\ ");
-      lval_print(e, v->formals);
-      putchar(' ');
-      lval_print(e, v->body);
-      putchar(')');
+/* skip whitespace and comments, keeping track of lines */
+static void lreader_skip(lreader *r) {
+  const lscan_kernels *k = lscan_kernels_get();
+  while (lreader_has(r, 0)) {
+    long rows = 0, nl = 0;
+    long i = k->space(r->s, r->pos, r->len, &rows, &nl);
+    if (rows) {
+      r->row += rows;
+      r->line = nl + 1;
+    }
+    r->pos = i;
+    if (i == r->len) {
+      continue;
+    }
+    if (r->s[i] != ';') {
+      return;
+    }
+    /* a comment runs to the end of the line */
+    while (lreader_has(r, 0)) {
+      r->pos = k->find(r->s, r->pos, r->len, '\n', '\r', '\r');
+      if (r->pos < r->len) {
+        break;
+      }
     }
-    break;
   }
 }
 
-void lval_println(lenv *e, lval *v) {
-  lval_print(e, v);
-  putchar('\n');
+/* the byte i past the cursor, or '\0' past the end of the input */
+static char lreader_at(lreader *r, long i) {
+  return lreader_has(r, i) ? r->s[r->pos + i] : '\0';
 }
 
-void lval_del(lval *v) {
-  switch (v->type) {
-  case LVAL_NUM:
-    break;
-  case LVAL_ERR:
+/* length of a number at the cursor following
+ * -?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)? or 0 if there is none,
+ * is_dbl is set when there is a fraction or exponent */
+static long lreader_number_len(lreader *r, int *is_dbl) {
+  long i = 0;
+  *is_dbl = 0;
+  if (lreader_at(r, i) == '-') {
+    i++;
+  }
+  long digits = i;
+  while (lreader_is_digit(lreader_at(r, i))) {
+    i++;
+  }
+  if (i == digits) {
+    return 0;
+  }
+  if (lreader_at(r, i) == '.' && lreader_is_digit(lreader_at(r, i + 1))) {
+    i += 2;
+    while (lreader_is_digit(lreader_at(r, i))) {
+      i++;
+    }
+    *is_dbl = 1;
+  }
+  char c = lreader_at(r, i);
+  if (c == 'e' || c == 'E') {
+    long j = i + 1;
+    if (lreader_at(r, j) == '-' || lreader_at(r, j) == '+') {
+      j++;
+    }
+    if (lreader_is_digit(lreader_at(r, j))) {
+      while (lreader_is_digit(lreader_at(r, j))) {
+        j++;
+      }
+      i = j;
+      *is_dbl = 1;
+    }
+  }
+  return i;
+}
+
+lval *lval_read_num(const char *s, long len, int is_dbl) {
+  /* copy out to terminate the token for strtod and the bignum reader */
+  char buf[64];
+  char *t = len < (long)sizeof(buf) ? buf : malloc(len + 1);
+  memcpy(t, s, len);
+  t[len] = '\0';
+
+  lval *v;
+  if (is_dbl) {
+    v = lval_dbl(strtod(t, NULL));
+  } else {
+    errno = 0;
+    long x = strtol(t, NULL, 10);
+    v = errno != ERANGE ? lval_num(x) : lval_read_big(t);
+  }
+  if (t != buf) {
+    free(t);
+  }
+  return v;
+}
+
+/* unescape a string body, the escapes are the ones mpcf_unescape knows */
+lval *lval_read_str(const char *s, long len) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_STR;
+  v->str = malloc(len + 1);
+  char *o = v->str;
+  for (long i = 0; i < len; i++) {
+    if (s[i] != '\\' || i + 1 == len) {
+      *o++ = s[i];
+      continue;
+    }
+    switch (s[i + 1]) {
+    case 'a':
+      *o++ = '\a';
+      break;
+    case 'b':
+      *o++ = '\b';
+      break;
+    case 'f':
+      *o++ = '\f';
+      break;
+    case 'n':
+      *o++ = '\n';
+      break;
+    case 'r':
+      *o++ = '\r';
+      break;
+    case 't':
+      *o++ = '\t';
+      break;
+    case 'v':
+      *o++ = '\v';
+      break;
+    case '\\':
+    case '\'':
+    case '"':
+      *o++ = s[i + 1];
+      break;
+    case '0':
+      *o++ = '\0';
+      break;
+    default:
+      /* unknown escapes are kept as they are */
+      *o++ = '\\';
+      *o++ = s[i + 1];
+      break;
+    }
+    i++;
+  }
+  *o = '\0';
+  return v;
+}
+
+static lval *lreader_string(lreader *r) {
+  const lscan_kernels *k = lscan_kernels_get();
+  long i = r->str_scan ? r->str_scan : 1;
+  r->str_scan = 0;
+  while (lreader_has(r, i)) {
+    /* jump to the next quote, escape or newline in what is buffered */
+    i = k->find(r->s, r->pos + i, r->len, '"', '\\', '\n') - r->pos;
+    if (r->pos + i == r->len) {
+      continue;
+    }
+    if (r->s[r->pos + i] == '"') {
+      lval *x = lval_read_str(r->s + r->pos + 1, i - 1);
+      r->pos += i + 1;
+      return x;
+    }
+    if (r->s[r->pos + i] == '\\' && lreader_has(r, i + 1)) {
+      i++;
+    } else if (r->s[r->pos + i] == '\\' && r->incremental) {
+      /* the escaped character is still to come */
+      break;
+    }
+    if (r->s[r->pos + i] == '\n') {
+      r->row++;
+      r->line = r->pos + i + 1;
+    }
+    i++;
+  }
+  if (r->incremental) {
+    /* carry on from here when there is more text */
+    r->str_scan = i;
+    return NULL;
+  }
+  r->pos += i;
+  return NULL;
+}
+
+/* what may come next in the innermost open list */
+static const char *lreader_expected(lreader *r) {
+  if (r->frames_num == 0) {
+    return "expression";
+  }
+  return r->frames[r->frames_num - 1].list->type == LVAL_SEXPR
+             ? "expression or ')'"
+             : "expression or '}'";
+}
+
+static void lreader_push_item(lreader *r, lval *x) {
+  if (r->items_num == r->items_slots) {
+    r->items_slots = r->items_slots ? r->items_slots * 2 : 64;
+    r->items = realloc(r->items, sizeof(lval *) * r->items_slots);
+  }
+  r->items[r->items_num++] = x;
+}
+
+static void lreader_open(lreader *r, lval *list) {
+  if (r->frames_num == r->frames_slots) {
+    r->frames_slots = r->frames_slots ? r->frames_slots * 2 : 16;
+    r->frames = realloc(r->frames, sizeof(lreader_frame) * r->frames_slots);
+  }
+  lreader_frame *f = &r->frames[r->frames_num++];
+  f->list = list;
+  f->first = r->items_num;
+  f->row = r->row;
+  f->col = r->pos - r->line;
+}
+
+/* move the items read since the innermost list opened into it */
+static lval *lreader_close(lreader *r) {
+  lreader_frame *f = &r->frames[--r->frames_num];
+  lval *list = f->list;
+  list->count = r->items_num - f->first;
+  if (list->count) {
+    list->cell = malloc(sizeof(lval *) * list->count);
+    memcpy(list->cell, r->items + f->first, sizeof(lval *) * list->count);
+  }
+  r->items_num = f->first;
+  return list;
+}
+
+/* read the next top level form, NULL once the input is used up or
+ * an error lval describing the first syntax error. An incremental reader
+ * also gives NULL when the input ends inside a form, keeping what it has
+ * of it. */
+lval *lval_read(lreader *r) {
+  while (1) {
+    lreader_skip(r);
+    if (!lreader_has(r, 0)) {
+      if (r->frames_num == 0 || r->incremental) {
+        return NULL;
+      }
+      return lreader_error(r, lreader_expected(r));
+    }
+
+    char c = r->s[r->pos];
+    lval *x;
+    if (c == '(' || c == '{') {
+      if (r->frames_num == LREADER_MAX_DEPTH) {
+        return lreader_too_deep(r);
+      }
+      lreader_open(r, c == '(' ? lval_sexpr() : lval_qexpr());
+      r->pos++;
+      continue;
+    } else if (c == ')' || c == '}') {
+      int want = c == ')' ? LVAL_SEXPR : LVAL_QEXPR;
+      if (r->frames_num == 0) {
+        return lreader_error(r, "expression");
+      }
+      if (r->frames[r->frames_num - 1].list->type != want) {
+        return lreader_error(r, want == LVAL_SEXPR ? "expression or '}'"
+                                                   : "expression or ')'");
+      }
+      r->pos++;
+      x = lreader_close(r);
+    } else if (c == '"') {
+      x = lreader_string(r);
+      if (!x) {
+        if (r->incremental) {
+          return NULL;
+        }
+        return lreader_error(r, "'\"' to end the string");
+      }
+    } else {
+      int is_dbl;
+      long n = lreader_number_len(r, &is_dbl);
+      if (n) {
+        x = lval_read_num(r->s + r->pos, n, is_dbl);
+      } else if (lreader_is_symbol(c)) {
+        n = 1;
+        while (lreader_is_symbol(lreader_at(r, n))) {
+          n++;
+        }
+        x = lval_sym_n(r->s + r->pos, n);
+      } else {
+        return lreader_error(r, lreader_expected(r));
+      }
+      r->pos += n;
+    }
+
+    if (r->frames_num == 0) {
+      return x;
+    }
+    lreader_push_item(r, x);
+  }
+}
+
+/* read every form left in the input into one S-Expression */
+lval *lval_read_all(lreader *r) {
+  lval *v = lval_sexpr();
+  lval *x;
+  while ((x = lval_read(r))) {
+    if (x->type == LVAL_ERR) {
+      lval_del(v);
+      return x;
+    }
+    lreader_push_item(r, x);
+  }
+  v->count = r->items_num;
+  if (v->count) {
+    v->cell = malloc(sizeof(lval *) * v->count);
+    memcpy(v->cell, r->items, sizeof(lval *) * v->count);
+  }
+  r->items_num = 0;
+  return v;
+}
+
+/* feed a line to an incremental reader. Gives NULL while a form is left
+ * open, otherwise everything read since the last complete line as one
+ * S-Expression, or the first syntax error. */
+lval *lval_read_line(lreader *r, const char *s, long len) {
+  lreader_feed(r, s, len);
+  lval *x;
+  while ((x = lval_read(r))) {
+    if (x->type == LVAL_ERR) {
+      /* the rest of the text goes with the form */
+      r->pos = r->len;
+      r->row = 0;
+      r->line = r->pos;
+      return x;
+    }
+    lreader_push_item(r, x);
+  }
+  if (r->frames_num > 0 || r->str_scan > 0) {
+    return NULL;
+  }
+  lval *v = lval_sexpr();
+  v->count = r->items_num;
+  if (v->count) {
+    v->cell = malloc(sizeof(lval *) * v->count);
+    memcpy(v->cell, r->items, sizeof(lval *) * v->count);
+  }
+  r->items_num = 0;
+  /* positions in errors count from the start of each expression */
+  r->row = 0;
+  r->line = r->pos;
+  return v;
+}
+
+/*
+ * Files
+ */
+
+/* 0 if the file can't be opened or read */
+int lfile_open(lfile *f, const char *filename) {
+  f->data = NULL;
+  f->len = 0;
+  f->mapped = 0;
+#ifdef LISPY_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      close(fd);
+      f->data = p;
+      f->len = st.st_size;
+      f->mapped = 1;
+      return 1;
+    }
+  }
+  close(fd);
+#endif
+  FILE *in = fopen(filename, "rb");
+  if (!in) {
+    return 0;
+  }
+  long slots = 4096;
+  size_t got;
+  f->data = malloc(slots);
+  while ((got = fread(f->data + f->len, 1, slots - f->len, in)) > 0) {
+    f->len += got;
+    if (f->len == slots) {
+      slots *= 2;
+      f->data = realloc(f->data, slots);
+    }
+  }
+  int failed = ferror(in);
+  fclose(in);
+  if (failed) {
+    lfile_close(f);
+    return 0;
+  }
+  return 1;
+}
+
+void lfile_close(lfile *f) {
+#ifdef LISPY_MMAP
+  if (f->mapped) {
+    munmap(f->data, f->len);
+    f->data = NULL;
+    return;
+  }
+#endif
+  free(f->data);
+  f->data = NULL;
+}
+
+/* size and modification time of a file, to tell whether it changed
+ * between two reads. Pipes and the like have size -1 */
+void lfile_stamp(FILE *f, long *size, long *mtime) {
+#ifdef LISPY_MMAP
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+    *size = st.st_size;
+    *mtime = (long)st.st_mtime;
+    return;
+  }
+  *size = -1;
+  *mtime = 0;
+#else
+  *size = lfile_size(f);
+  *mtime = 0;
+#endif
+}
+
+/* size of a regular file or -1 for pipes and the like */
+long lfile_size(FILE *f) {
+#ifdef LISPY_MMAP
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return -1;
+  }
+  return st.st_size;
+#else
+  long pos = ftell(f);
+  if (pos < 0 || fseek(f, 0, SEEK_END) != 0) {
+    return -1;
+  }
+  long size = ftell(f);
+  fseek(f, pos, SEEK_SET);
+  return size;
+#endif
+}
+
+/*
+ * Cache
+ *
+ * Loading a file stores the forms read from it in a compact binary file
+ * so later loads can skip the reader. The cache sits next to the source
+ * as <file>c for .lispy files (<file>.lispyc otherwise), or in
+ * $LISPY_CACHE_DIR named after the hash. It is keyed by an FNV-1a hash
+ * of the source, and anything that doesn't match is ignored and
+ * rewritten. Setting LISPY_NO_CACHE turns it off.
+ *
+ * Layout, integers little endian:
+ *   "LSPC" u32 version u64 source hash u64 source length
+ *   u64 length of the nodes u64 number of forms
+ *   then one node per form, a node being a type byte (its LVAL_* value)
+ *   followed by
+ *     NUM     zigzag varint
+ *     BIGNUM  sign byte, varint count, count u32 limbs
+ *     DBL     u64 bit pattern
+ *     SYM STR ERR varint length, bytes
+ *     SEXPR QEXPR varint count, count nodes
+ *     FUN     byte 1 and the builtin's name as a SYM, or byte 0 and a
+ *             varint count of environment entries, each a SYM node
+ *             and its value, then the formals and body nodes
+ *     I64VEC F64VEC varint count, count u64 elements
+ *
+ * Images of a whole environment use the same nodes after a header of
+ * "LSPI" u32 version, holding a varint count of SYM and value pairs.
+ */
+
+#define LCACHE_MAGIC "LSPC"
+#define LIMAGE_MAGIC "LSPI"
+#define LCACHE_VERSION 2
+#define LCACHE_HEADER 40
+
+/* growable byte buffer */
+typedef struct {
+  char *data;
+  long len;
+  long slots;
+} lbuf;
+
+static void lbuf_reserve(lbuf *b, long n) {
+  if (b->len + n > b->slots) {
+    while (b->len + n > b->slots) {
+      b->slots = b->slots ? b->slots * 2 : 4096;
+    }
+    b->data = realloc(b->data, b->slots);
+  }
+}
+
+static void lbuf_put(lbuf *b, const void *p, long n) {
+  lbuf_reserve(b, n);
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static void lbuf_byte(lbuf *b, int c) {
+  lbuf_reserve(b, 1);
+  b->data[b->len++] = (char)c;
+}
+
+static void lbuf_u32(lbuf *b, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    lbuf_byte(b, (x >> (8 * i)) & 0xff);
+  }
+}
+
+static void lbuf_u64(lbuf *b, uint64_t x) {
+  for (int i = 0; i < 8; i++) {
+    lbuf_byte(b, (x >> (8 * i)) & 0xff);
+  }
+}
+
+static void lbuf_varint(lbuf *b, uint64_t x) {
+  while (x >= 0x80) {
+    lbuf_byte(b, (x & 0x7f) | 0x80);
+    x >>= 7;
+  }
+  lbuf_byte(b, x);
+}
+
+uint64_t lcache_hash(const char *s, long len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (long i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* append the binary form of a value the reader can produce */
+void lcache_put(lbuf *b, lval *v) {
+  lbuf_byte(b, v->type);
+  switch (v->type) {
+  case LVAL_NUM: {
+    uint64_t z = (uint64_t)v->num << 1;
+    lbuf_varint(b, v->num < 0 ? ~z : z);
+    break;
+  }
+  case LVAL_BIGNUM:
+    lbuf_byte(b, v->big.sign < 0);
+    lbuf_varint(b, v->big.count);
+    for (int i = 0; i < v->big.count; i++) {
+      lbuf_u32(b, v->big.limb[i]);
+    }
+    break;
+  case LVAL_DBL: {
+    uint64_t bits;
+    memcpy(&bits, &v->dbl, sizeof(bits));
+    lbuf_u64(b, bits);
+    break;
+  }
+  case LVAL_SYM:
+  case LVAL_STR:
+  case LVAL_ERR: {
+    char *s = v->type == LVAL_SYM ? v->sym
+              : v->type == LVAL_STR ? v->str
+                                    : v->err;
+    long n = strlen(s);
+    lbuf_varint(b, n);
+    lbuf_put(b, s, n);
+    break;
+  }
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    lbuf_varint(b, v->count);
+    for (int i = 0; i < v->count; i++) {
+      lcache_put(b, v->cell[i]);
+    }
+    break;
+  case LVAL_FUN:
+    if (v->builtin) {
+      const char *name = lbuiltin_name(v->builtin);
+      long n = strlen(name);
+      lbuf_byte(b, 1);
+      lbuf_byte(b, LVAL_SYM);
+      lbuf_varint(b, n);
+      lbuf_put(b, name, n);
+    } else {
+      lbuf_byte(b, 0);
+      lbuf_varint(b, v->env->count);
+      for (int i = 0; i < v->env->count; i++) {
+        long n = strlen(v->env->syms[i]);
+        lbuf_byte(b, LVAL_SYM);
+        lbuf_varint(b, n);
+        lbuf_put(b, v->env->syms[i], n);
+        lcache_put(b, v->env->vals[i]);
+      }
+      lcache_put(b, v->formals);
+      lcache_put(b, v->body);
+    }
+    break;
+  case LVAL_I64VEC:
+  case LVAL_F64VEC:
+    lbuf_varint(b, v->count);
+    for (int i = 0; i < v->count; i++) {
+      uint64_t bits;
+      memcpy(&bits, v->type == LVAL_I64VEC ? (void *)&v->i64[i]
+                                           : (void *)&v->f64[i],
+             sizeof(bits));
+      lbuf_u64(b, bits);
+    }
+    break;
+  }
+}
+
+/* cursor over cached bytes, any read past the end marks it bad */
+typedef struct {
+  const unsigned char *s;
+  long len;
+  long pos;
+  int bad;
+} lcache_in;
+
+static uint64_t lcache_u(lcache_in *in, int n) {
+  if (in->len - in->pos < n) {
+    in->bad = 1;
+    return 0;
+  }
+  uint64_t x = 0;
+  for (int i = 0; i < n; i++) {
+    x |= (uint64_t)in->s[in->pos++] << (8 * i);
+  }
+  return x;
+}
+
+static uint64_t lcache_varint(lcache_in *in) {
+  uint64_t x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in->pos >= in->len) {
+      break;
+    }
+    unsigned char c = in->s[in->pos++];
+    x |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return x;
+    }
+  }
+  in->bad = 1;
+  return 0;
+}
+
+/* a varint count no larger than the bytes left could hold */
+static long lcache_count(lcache_in *in, long unit) {
+  uint64_t n = lcache_varint(in);
+  if (n > (uint64_t)(in->len - in->pos) / unit) {
+    in->bad = 1;
+    return 0;
+  }
+  return (long)n;
+}
+
+lval *lcache_get(lcache_in *in);
+
+/* a SYM node, NULL if the next node is anything else */
+static lval *lcache_get_sym(lcache_in *in) {
+  lval *v = lcache_get(in);
+  if (v && v->type != LVAL_SYM) {
+    lval_del(v);
+    in->bad = 1;
+    return NULL;
+  }
+  return v;
+}
+
+static lval *lcache_get_fun(lcache_in *in) {
+  int builtin = (int)lcache_u(in, 1);
+  if (in->bad) {
+    return NULL;
+  }
+  if (builtin) {
+    lval *name = lcache_get_sym(in);
+    if (!name) {
+      return NULL;
+    }
+    lbuiltin func = lbuiltin_find(name->sym);
+    lval_del(name);
+    if (!func) {
+      in->bad = 1;
+      return NULL;
+    }
+    return lval_fun(func);
+  }
+
+  long n = lcache_count(in, 2);
+  if (in->bad) {
+    return NULL;
+  }
+  lenv *env = lenv_new();
+  for (long i = 0; i < n; i++) {
+    lval *k = lcache_get_sym(in);
+    lval *v = k ? lcache_get(in) : NULL;
+    if (!v) {
+      if (k) {
+        lval_del(k);
+      }
+      lenv_del(env);
+      return NULL;
+    }
+    lenv_put(env, k, v);
+    lval_del(k);
+    lval_del(v);
+  }
+  lval *formals = lcache_get(in);
+  lval *body = formals ? lcache_get(in) : NULL;
+  if (!body) {
+    if (formals) {
+      lval_del(formals);
+    }
+    lenv_del(env);
+    return NULL;
+  }
+  lval *f = lval_lambda(formals, body);
+  lenv_del(f->env);
+  f->env = env;
+  return f;
+}
+
+/* read one node back, NULL if the data is malformed */
+lval *lcache_get(lcache_in *in) {
+  int type = (int)lcache_u(in, 1);
+  if (in->bad) {
+    return NULL;
+  }
+  switch (type) {
+  case LVAL_NUM: {
+    uint64_t z = lcache_varint(in);
+    return in->bad ? NULL : lval_num((long)((z >> 1) ^ (0 - (z & 1))));
+  }
+  case LVAL_BIGNUM: {
+    lbig big;
+    big.sign = lcache_u(in, 1) ? -1 : 1;
+    big.count = (int)lcache_count(in, 4);
+    if (in->bad || big.count == 0) {
+      return NULL;
+    }
+    big.limb = malloc(sizeof(uint32_t) * big.count);
+    for (int i = 0; i < big.count; i++) {
+      big.limb[i] = (uint32_t)lcache_u(in, 4);
+    }
+    return lval_bignum(big);
+  }
+  case LVAL_DBL: {
+    uint64_t bits = lcache_u(in, 8);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return in->bad ? NULL : lval_dbl(d);
+  }
+  case LVAL_SYM:
+  case LVAL_STR:
+  case LVAL_ERR: {
+    long n = lcache_count(in, 1);
+    if (in->bad) {
+      return NULL;
+    }
+    lval *v = lval_sym_n((const char *)in->s + in->pos, n);
+    in->pos += n;
+    if (type == LVAL_STR) {
+      v->type = LVAL_STR;
+      v->str = v->sym;
+    } else if (type == LVAL_ERR) {
+      v->type = LVAL_ERR;
+      v->err = v->sym;
+    }
+    return v;
+  }
+  case LVAL_FUN:
+    return lcache_get_fun(in);
+  case LVAL_I64VEC:
+  case LVAL_F64VEC: {
+    long n = lcache_count(in, 8);
+    if (in->bad) {
+      return NULL;
+    }
+    lval *v = type == LVAL_I64VEC ? lval_i64vec(n) : lval_f64vec(n);
+    for (long i = 0; i < n; i++) {
+      uint64_t bits = lcache_u(in, 8);
+      memcpy(type == LVAL_I64VEC ? (void *)&v->i64[i] : (void *)&v->f64[i],
+             &bits, sizeof(bits));
+    }
+    return v;
+  }
+  case LVAL_SEXPR:
+  case LVAL_QEXPR: {
+    long n = lcache_count(in, 1);
+    if (in->bad) {
+      return NULL;
+    }
+    lval *v = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+    v->count = (int)n;
+    v->cell = n ? malloc(sizeof(lval *) * n) : NULL;
+    for (long i = 0; i < n; i++) {
+      v->cell[i] = lcache_get(in);
+      if (!v->cell[i]) {
+        v->count = (int)i;
+        lval_del(v);
+        return NULL;
+      }
+    }
+    return v;
+  }
+  }
+  in->bad = 1;
+  return NULL;
+}
+
+/* where the cache for a source lives, NULL when caching is off */
+static char *lcache_path(const char *filename, uint64_t hash) {
+  if (getenv("LISPY_NO_CACHE")) {
+    return NULL;
+  }
+  const char *dir = getenv("LISPY_CACHE_DIR");
+  if (dir && *dir) {
+    char *path = malloc(strlen(dir) + 32);
+    sprintf(path, "%s/%016llx.lispyc", dir, (unsigned long long)hash);
+    return path;
+  }
+  long n = strlen(filename);
+  char *path = malloc(n + 8);
+  strcpy(path, filename);
+  if (n > 6 && strcmp(filename + n - 6, ".lispy") == 0) {
+    strcat(path, "c");
+  } else {
+    strcat(path, ".lispyc");
+  }
+  return path;
+}
+
+/* walk the nodes without building them, 0 if they are malformed or
+ * don't make up exactly forms forms */
+static int lcache_check(lcache_in in, uint64_t forms) {
+  long pending = 0;
+  uint64_t seen = 0;
+  while (in.pos < in.len || pending) {
+    if (pending) {
+      pending--;
+    } else {
+      seen++;
+    }
+    int type = (int)lcache_u(&in, 1);
+    switch (type) {
+    case LVAL_NUM:
+      lcache_varint(&in);
+      break;
+    case LVAL_BIGNUM: {
+      lcache_u(&in, 1);
+      long n = lcache_count(&in, 4);
+      in.bad |= n == 0;
+      in.pos += 4 * n;
+      break;
+    }
+    case LVAL_DBL:
+      lcache_u(&in, 8);
+      break;
+    case LVAL_SYM:
+    case LVAL_STR:
+    case LVAL_ERR:
+      in.pos += lcache_count(&in, 1);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      pending += lcache_count(&in, 1);
+      break;
+    case LVAL_FUN:
+      if (lcache_u(&in, 1)) {
+        pending += 1;
+      } else {
+        pending += 2 * lcache_count(&in, 2) + 2;
+      }
+      break;
+    case LVAL_I64VEC:
+    case LVAL_F64VEC:
+      in.pos += 8 * lcache_count(&in, 8);
+      break;
+    default:
+      in.bad = 1;
+    }
+    if (in.bad) {
+      return 0;
+    }
+  }
+  return seen == forms;
+}
+
+/* open the cache for a source, 0 when it is missing, stale or damaged,
+ * otherwise in is left at the first form */
+static int lcache_open(lfile *file, lcache_in *in, const char *path,
+                       uint64_t hash, long src_len) {
+  if (!lfile_open(file, path)) {
+    return 0;
+  }
+  in->s = (const unsigned char *)file->data;
+  in->len = file->len;
+  in->pos = 4;
+  in->bad = 0;
+  if (file->len >= LCACHE_HEADER &&
+      memcmp(file->data, LCACHE_MAGIC, 4) == 0 &&
+      lcache_u(in, 4) == LCACHE_VERSION && lcache_u(in, 8) == hash &&
+      lcache_u(in, 8) == (uint64_t)src_len &&
+      lcache_u(in, 8) == (uint64_t)(file->len - LCACHE_HEADER)) {
+    uint64_t forms = lcache_u(in, 8);
+    if (lcache_check(*in, forms)) {
+      return 1;
+    }
+  }
+  lfile_close(file);
+  return 0;
+}
+
+/* write the cache through a temporary file of its own next to it, so
+ * neither readers nor others storing the same cache see a partial one,
+ * failing quietly as the cache is only an optimisation */
+static void lcache_store(const char *path, uint64_t hash, long src_len,
+                         lbuf *forms, long count) {
+  lbuf b = {NULL, 0, 0};
+  lbuf_put(&b, LCACHE_MAGIC, 4);
+  lbuf_u32(&b, LCACHE_VERSION);
+  lbuf_u64(&b, hash);
+  lbuf_u64(&b, (uint64_t)src_len);
+  lbuf_u64(&b, (uint64_t)forms->len);
+  lbuf_u64(&b, (uint64_t)count);
+  lbuf_put(&b, forms->data, forms->len);
+
+  char *tmp = malloc(strlen(path) + 48);
+#ifdef LISPY_MMAP
+  /* named after the process, and created exclusively in case another
+   * thread or a dead process with the same id left one behind */
+  int fd = -1;
+  for (int i = 0; fd < 0 && i < 64; i++) {
+    sprintf(tmp, "%s.%ld.%d.tmp", path, (long)getpid(), i);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (fd >= 0) {
+    long done = 0;
+    ssize_t n = 1;
+    while (done < b.len && n > 0) {
+      n = write(fd, b.data + done, b.len - done);
+      if (n > 0) {
+        done += n;
+      } else if (n < 0 && errno == EINTR) {
+        n = 1;
+      }
+    }
+    int ok = done == b.len && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+      unlink(tmp);
+    }
+  }
+#else
+  sprintf(tmp, "%s.tmp", path);
+  FILE *f = fopen(tmp, "wb");
+  if (f) {
+    int ok = fwrite(b.data, 1, b.len, f) == (size_t)b.len;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+      remove(tmp);
+    }
+  }
+#endif
+  free(tmp);
+  free(b.data);
+}
+
+/* evaluate a top level form, printing it if it is an error */
+static void lval_eval_form(lenv *e, lval *v) {
+  lval *x = lval_eval(e, v);
+  if (x->type == LVAL_ERR) {
+    lval_println(e, x);
+  }
+  lval_del(x);
+}
+
+/* evaluate a form, or keep it in forms when there is no environment */
+static void lcache_take(lenv *e, lval *forms, lval *x) {
+  if (e) {
+    lval_eval_form(e, x);
+  } else {
+    lval_add(forms, x);
+  }
+}
+
+/* evaluate each form of a source file in turn, taking them from its cache
+ * when that is current and otherwise reading them and caching them for
+ * next time. With no environment the forms are added to forms instead,
+ * to be evaluated later. Returns the syntax error if there is one. */
+lval *lcache_eval(lenv *e, lval *forms, const char *filename, FILE *f,
+                  long size) {
+  char *src = malloc(size + 1);
+  long len = fread(src, 1, size, f);
+  uint64_t hash = lcache_hash(src, len);
+#ifdef LISPY_BAKED_PRELUDE
+  if (lbaked_prelude_loaded(hash, len)) {
+    free(src);
+    return NULL;
+  }
+#endif
+  char *path = lcache_path(filename, hash);
+  lval *err = NULL;
+
+  lfile file;
+  lcache_in in;
+  if (path && lcache_open(&file, &in, path, hash, len)) {
+    free(src);
+    lval *x;
+    while (in.pos < in.len && (x = lcache_get(&in))) {
+      lcache_take(e, forms, x);
+    }
+    lfile_close(&file);
+  } else {
+    lreader r;
+    lreader_init(&r, filename, src, len);
+    lbuf b = {NULL, 0, 0};
+    long count = 0;
+    lval *x;
+    while ((x = lval_read(&r))) {
+      if (x->type == LVAL_ERR) {
+        err = x;
+        break;
+      }
+      if (path) {
+        lcache_put(&b, x);
+        count++;
+      }
+      lcache_take(e, forms, x);
+    }
+    lreader_free(&r);
+    free(src);
+    if (path && !err) {
+      lcache_store(path, hash, len, &b, count);
+    }
+    free(b.data);
+  }
+
+  free(path);
+  return err;
+}
+
+/*
+ * Command line files
+ *
+ * When several files are given they are read ahead on a pool of threads,
+ * one file per job, while the main thread evaluates them in the order
+ * they were given. Reading doesn't touch the environment so only the
+ * evaluation has to wait, and each file waits just for its own reading.
+ * The readers stay at most LLOAD_AHEAD files per thread ahead of the
+ * evaluation, so only that many files' forms are held at once. Setting
+ * LISPY_CPUS fixes the number of threads, LISPY_CPUS=1 reads serially.
+ * Files too big for the cache are left to builtin_load to stream when
+ * their turn comes, as are files that can't be opened. A file named "-"
+ * is standard input, whose forms are evaluated as each one arrives.
+ */
+
+typedef struct {
+  char *filename;
+  lval *forms;
+  lval *err;
+  int done;
+} lload;
+
+#define LLOAD_AHEAD 2
+
+typedef struct {
+  lload *files;
+  int count;
+  /* files handed out and files evaluated */
+  int next;
+  int evaluated;
+  int window;
+#ifdef LISPY_THREADS
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+#endif
+} lload_pool;
+
+/* read every form of a file, leaving forms NULL when it is to be loaded
+ * the usual way instead */
+static void lload_read(lload *l) {
+  l->forms = NULL;
+  l->err = NULL;
+  if (strcmp(l->filename, "-") == 0) {
+    return;
+  }
+  FILE *f = fopen(l->filename, "rb");
+  if (!f) {
+    return;
+  }
+  long size = lfile_size(f);
+  if (size >= 0 && size <= LCACHE_MAX_SOURCE) {
+    l->forms = lval_sexpr();
+    l->err = lcache_eval(NULL, l->forms, l->filename, f, size);
+  }
+  fclose(f);
+}
+
+#ifdef LISPY_THREADS
+/* how many threads to read on, $LISPY_CPUS when that is set */
+int lload_cpus(void) {
+  const char *force = getenv("LISPY_CPUS");
+  long cpus = force ? atol(force) : sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus < 1 ? 1 : cpus > INT_MAX ? INT_MAX : (int)cpus;
+}
+
+static void *lload_worker(void *arg) {
+  lload_pool *p = arg;
+  pthread_mutex_lock(&p->lock);
+  while (p->next < p->count) {
+    if (p->next >= p->evaluated + p->window) {
+      pthread_cond_wait(&p->ready, &p->lock);
+      continue;
+    }
+    lload *l = &p->files[p->next++];
+    pthread_mutex_unlock(&p->lock);
+    lload_read(l);
+    pthread_mutex_lock(&p->lock);
+    l->done = 1;
+    pthread_cond_broadcast(&p->ready);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+#endif
+
+/* evaluate forms from standard input one at a time as they come in, so
+ * memory stays bounded however much is piped through. Output reaches a
+ * pipe in batches, flushed whenever the reader has to wait for input. */
+static lval *lload_stdin(lenv *e) {
+  lreader r;
+  lreader_init_file(&r, "<stdin>", stdin);
+  lval *x;
+  while ((x = lval_read(&r))) {
+    if (x->type == LVAL_ERR) {
+      lreader_free(&r);
+      return x;
+    }
+    lval_eval_form(e, x);
+  }
+  lreader_free(&r);
+  return lval_sexpr();
+}
+
+/* evaluate the forms read ahead for a file, giving what builtin_load
+ * would */
+static lval *lload_eval(lenv *e, lload *l) {
+  for (int i = 0; i < l->forms->count; i++) {
+    lval_eval_form(e, l->forms->cell[i]);
+  }
+  l->forms->count = 0;
+  lval_del(l->forms);
+  if (l->err) {
+    lval *err = lval_err("Could not load library %s", l->err->err);
+    lval_del(l->err);
+    return err;
+  }
+  return lval_sexpr();
+}
+
+/* load the files in order, printing any errors */
+void lload_files(lenv *e, char **filenames, int count) {
+  lload_pool p;
+  p.files = calloc(count ? count : 1, sizeof(lload));
+  p.count = count;
+  p.next = 0;
+  p.evaluated = 0;
+  p.window = count;
+  for (int i = 0; i < count; i++) {
+    p.files[i].filename = filenames[i];
+  }
+
+#ifdef LISPY_THREADS
+  int threads = 0;
+  pthread_t *pool = NULL;
+  if (count > 1) {
+    threads = lload_cpus();
+    threads = threads > count ? count : threads;
+    p.window = threads * LLOAD_AHEAD;
+    pool = malloc(sizeof(pthread_t) * threads);
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.ready, NULL);
+    for (int i = 0; i < threads; i++) {
+      if (pthread_create(&pool[i], NULL, lload_worker, &p) != 0) {
+        /* any started threads still get through every file */
+        threads = i;
+        break;
+      }
+    }
+  }
+#endif
+
+  for (int i = 0; i < count; i++) {
+    lload *l = &p.files[i];
+#ifdef LISPY_THREADS
+    if (threads) {
+      pthread_mutex_lock(&p.lock);
+      while (!l->done) {
+        pthread_cond_wait(&p.ready, &p.lock);
+      }
+      pthread_mutex_unlock(&p.lock);
+    }
+#endif
+
+    lval *x;
+    if (l->forms) {
+      x = lload_eval(e, l);
+    } else if (strcmp(l->filename, "-") == 0) {
+      x = lload_stdin(e);
+    } else {
+      x = builtin_load(e, lval_add(lval_sexpr(), lval_str(l->filename)));
+    }
+    if (x->type == LVAL_ERR) {
+      lval_println(e, x);
+    }
+    lval_del(x);
+
+#ifdef LISPY_THREADS
+    /* let the readers move on to the next file */
+    if (threads) {
+      pthread_mutex_lock(&p.lock);
+      p.evaluated = i + 1;
+      pthread_cond_broadcast(&p.ready);
+      pthread_mutex_unlock(&p.lock);
+    }
+#endif
+  }
+
+#ifdef LISPY_THREADS
+  if (threads) {
+    for (int i = 0; i < threads; i++) {
+      pthread_join(pool[i], NULL);
+    }
+    pthread_cond_destroy(&p.ready);
+    pthread_mutex_destroy(&p.lock);
+    free(pool);
+  }
+#endif
+  free(p.files);
+}
+
+/*
+ * Split reading
+ *
+ * A big file is cut into chunks of about LSPLIT_CHUNK bytes, each ending
+ * on a line break between top level forms, and the chunks are read on a
+ * pool of threads. They are kept small so the forms of a chunk are still
+ * in cache when the main thread gets to them. Finding a cut only needs
+ * to follow nesting, strings and comments, which is much cheaper than
+ * reading, so it's done in order as chunks are handed out. The main
+ * thread evaluates the chunks in order and the readers stay at most
+ * LSPLIT_AHEAD chunks per thread ahead of it, so memory stays bounded
+ * however big the file is. Only files over LCACHE_MAX_SOURCE are split,
+ * on lload_cpus() threads.
+ */
+
+#ifdef LISPY_THREADS
+
+#define LSPLIT_CHUNK (64L << 10)
+#define LSPLIT_AHEAD 2
+
+typedef struct {
+  long start;
+  long end;
+  long row;
+  lval *forms;
+  lval *err;
+  int done;
+} lsplit_chunk;
+
+typedef struct {
+  const char *filename;
+  const char *s;
+  long len;
+  /* where the next chunk starts */
+  long cut;
+  long cut_row;
+  /* chunks handed out and chunks evaluated, the ones in between live in
+   * a ring of window slots */
+  long claimed;
+  long evaluated;
+  int window;
+  lsplit_chunk *chunks;
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+} lsplit;
+
+/* end of the chunk starting at i, just past the first line break at the
+ * top level from want on, counting line breaks into rows on the way */
+static long lsplit_cut(const char *s, long i, long n, long want, long *rows) {
+  long depth = 0;
+  while (i < n) {
+    switch (s[i++]) {
+    case '\n':
+      (*rows)++;
+      if (depth == 0 && i >= want) {
+        return i;
+      }
+      break;
+    case '(':
+    case '{':
+      depth++;
+      break;
+    case ')':
+    case '}':
+      /* a stray one is left for the reader to complain about */
+      if (depth > 0) {
+        depth--;
+      }
+      break;
+    case ';':
+      while (i < n && s[i] != '\n' && s[i] != '\r') {
+        i++;
+      }
+      break;
+    case '"':
+      while (i < n && s[i] != '"') {
+        if (s[i] == '\\' && i + 1 < n) {
+          i++;
+        }
+        if (s[i] == '\n') {
+          (*rows)++;
+        }
+        i++;
+      }
+      i++;
+      break;
+    }
+  }
+  return n;
+}
+
+static void lsplit_read(lsplit *p, lsplit_chunk *c) {
+  lreader r;
+  lreader_init(&r, p->filename, p->s + c->start, c->end - c->start);
+  r.row = c->row;
+  c->forms = lval_sexpr();
+  c->err = NULL;
+  int slots = 0;
+  lval *x;
+  while ((x = lval_read(&r))) {
+    if (x->type == LVAL_ERR) {
+      c->err = x;
+      break;
+    }
+    if (c->forms->count == slots) {
+      slots = slots ? slots * 2 : 64;
+      c->forms->cell = realloc(c->forms->cell, sizeof(lval *) * slots);
+    }
+    c->forms->cell[c->forms->count++] = x;
+  }
+  lreader_free(&r);
+}
+
+static void *lsplit_worker(void *arg) {
+  lsplit *p = arg;
+  pthread_mutex_lock(&p->lock);
+  while (1) {
+    while (!p->stop && p->cut < p->len &&
+           p->claimed - p->evaluated >= p->window) {
+      pthread_cond_wait(&p->ready, &p->lock);
+    }
+    if (p->stop || p->cut >= p->len) {
+      break;
+    }
+    lsplit_chunk *c = &p->chunks[p->claimed++ % p->window];
+    c->start = p->cut;
+    c->row = p->cut_row;
+    c->done = 0;
+    c->end = lsplit_cut(p->s, p->cut, p->len, p->cut + LSPLIT_CHUNK,
+                        &p->cut_row);
+    p->cut = c->end;
+    pthread_mutex_unlock(&p->lock);
+
+    lsplit_read(p, c);
+
+    pthread_mutex_lock(&p->lock);
+    c->done = 1;
+    pthread_cond_broadcast(&p->ready);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+/* evaluate every form of s on threads readers, 0 if none could be
+ * started. err is set to the syntax error if there is one, the forms
+ * before it are evaluated as they would be reading the file in order */
+int lsplit_eval(lenv *e, const char *filename, const char *s, long len,
+                int threads, lval **err) {
+  lsplit p;
+  p.filename = filename;
+  p.s = s;
+  p.len = len;
+  p.cut = 0;
+  p.cut_row = 0;
+  p.claimed = 0;
+  p.evaluated = 0;
+  p.window = threads * LSPLIT_AHEAD;
+  p.chunks = malloc(sizeof(lsplit_chunk) * p.window);
+  p.stop = 0;
+  pthread_mutex_init(&p.lock, NULL);
+  pthread_cond_init(&p.ready, NULL);
+
+  pthread_t *pool = malloc(sizeof(pthread_t) * threads);
+  int started = 0;
+  while (started < threads &&
+         pthread_create(&pool[started], NULL, lsplit_worker, &p) == 0) {
+    started++;
+  }
+
+  *err = NULL;
+  for (long k = 0; started && !*err; k++) {
+    lsplit_chunk *c = &p.chunks[k % p.window];
+    pthread_mutex_lock(&p.lock);
+    while (!(k < p.claimed && c->done) &&
+           !(k == p.claimed && p.cut >= p.len)) {
+      pthread_cond_wait(&p.ready, &p.lock);
+    }
+    int finished = k == p.claimed;
+    pthread_mutex_unlock(&p.lock);
+    if (finished) {
+      break;
+    }
+
+    for (int i = 0; i < c->forms->count; i++) {
+      lval_eval_form(e, c->forms->cell[i]);
+    }
+    c->forms->count = 0;
+    lval_del(c->forms);
+    *err = c->err;
+
+    pthread_mutex_lock(&p.lock);
+    p.evaluated = k + 1;
+    p.stop = *err != NULL;
+    pthread_cond_broadcast(&p.ready);
+    pthread_mutex_unlock(&p.lock);
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(pool[i], NULL);
+  }
+  /* chunks read past a syntax error are thrown away */
+  for (long k = p.evaluated; k < p.claimed; k++) {
+    lsplit_chunk *c = &p.chunks[k % p.window];
+    lval_del(c->forms);
+    if (c->err) {
+      lval_del(c->err);
+    }
+  }
+  pthread_cond_destroy(&p.ready);
+  pthread_mutex_destroy(&p.lock);
+  free(pool);
+  free(p.chunks);
+  return started > 0;
+}
+
+#endif
+
+/* write every binding of an environment to an image file */
+lval *limage_save(lenv *e, const char *path) {
+  lbuf b = {NULL, 0, 0};
+  lbuf_put(&b, LIMAGE_MAGIC, 4);
+  lbuf_u32(&b, LCACHE_VERSION);
+  lbuf_varint(&b, e->count);
+  for (int i = 0; i < e->count; i++) {
+    long n = strlen(e->syms[i]);
+    lbuf_byte(&b, LVAL_SYM);
+    lbuf_varint(&b, n);
+    lbuf_put(&b, e->syms[i], n);
+    lcache_put(&b, e->vals[i]);
+  }
+
+  FILE *f = fopen(path, "wb");
+  int ok = f && fwrite(b.data, 1, b.len, f) == (size_t)b.len;
+  if (f) {
+    ok = fclose(f) == 0 && ok;
+  }
+  free(b.data);
+  if (!ok) {
+    return lval_err("Could not save image %s", path);
+  }
+  return lval_sexpr();
+}
+
+/* rebuild an environment saved by limage_save, NULL if the image can't
+ * be read or is damaged */
+lenv *limage_load(const char *path) {
+  lfile file;
+  if (!lfile_open(&file, path)) {
+    return NULL;
+  }
+  lcache_in in = {(const unsigned char *)file.data, file.len, 4, 0};
+  if (file.len < 8 || memcmp(file.data, LIMAGE_MAGIC, 4) != 0 ||
+      lcache_u(&in, 4) != LCACHE_VERSION) {
+    lfile_close(&file);
+    return NULL;
+  }
+
+  lenv *e = lenv_new();
+  long n = lcache_count(&in, 2);
+  for (long i = 0; i < n && !in.bad; i++) {
+    lval *k = lcache_get_sym(&in);
+    lval *v = k ? lcache_get(&in) : NULL;
+    if (v) {
+      /* append directly, the names in an image are already distinct */
+      e->count++;
+      e->syms = realloc(e->syms, sizeof(char *) * e->count);
+      e->vals = realloc(e->vals, sizeof(lval *) * e->count);
+      e->syms[e->count - 1] = k->sym;
+      e->vals[e->count - 1] = v;
+      free(k);
+    } else if (k) {
+      lval_del(k);
+    }
+  }
+  int bad = in.bad || in.pos != in.len;
+  lfile_close(&file);
+  if (bad) {
+    lenv_del(e);
+    return NULL;
+  }
+  return e;
+}
+
+/*
+ * Baking
+ *
+ * lispyc --emit-c out.c prelude.lispy writes the forms read from the
+ * prelude as static lvals. Building with -DLISPY_BAKED_PRELUDE compiles
+ * out.c (named prelude_baked.c) in, so the prelude is evaluated from
+ * memory at startup without touching the file system. Loading a file
+ * with the same contents later, by load or on the command line, is
+ * then a no-op, and loading one of the same name that is missing runs
+ * the baked forms. Symbols and strings are interned so each distinct
+ * text is emitted once.
+ */
+
+typedef struct {
+  FILE *out;
+  int next;
+  char **texts;
+  int texts_num;
+} lbake;
+
+static void lbake_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\' || c == '?') {
+      fprintf(out, "\\%c", c);
+    } else if (c < ' ' || c > '~') {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/* index of the static char array holding s */
+static int lbake_text(lbake *b, const char *s) {
+  for (int i = 0; i < b->texts_num; i++) {
+    if (strcmp(b->texts[i], s) == 0) {
+      return i;
+    }
+  }
+  b->texts = realloc(b->texts, sizeof(char *) * (b->texts_num + 1));
+  b->texts[b->texts_num] = (char *)s;
+  fprintf(b->out, "static char lbaked_t%i[] = ", b->texts_num);
+  lbake_string(b->out, s);
+  fputs(";\n", b->out);
+  return b->texts_num++;
+}
+
+/* emit v after its children, returning the index of its static lval */
+static int lbake_emit(lbake *b, lval *v) {
+  FILE *out = b->out;
+  /* index of the cell array or text v refers to */
+  int cells = 0;
+  if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+    int *ids = malloc(sizeof(int) * (v->count ? v->count : 1));
+    for (int i = 0; i < v->count; i++) {
+      ids[i] = lbake_emit(b, v->cell[i]);
+    }
+    cells = b->next;
+    fprintf(out, "static lval *lbaked_c%i[] = {", cells);
+    for (int i = 0; i < v->count; i++) {
+      fprintf(out, "%s&lbaked_v%i", i ? ", " : "", ids[i]);
+    }
+    fputs(v->count ? "};\n" : "NULL};\n", out);
+    free(ids);
+  } else if (v->type == LVAL_BIGNUM) {
+    fprintf(out, "static uint32_t lbaked_l%i[] = {", b->next);
+    for (int i = 0; i < v->big.count; i++) {
+      fprintf(out, "%s%luu", i ? ", " : "", (unsigned long)v->big.limb[i]);
+    }
+    fputs("};\n", out);
+  } else if (v->type == LVAL_SYM || v->type == LVAL_STR) {
+    cells = lbake_text(b, v->type == LVAL_SYM ? v->sym : v->str);
+  }
+
+  int id = b->next++;
+  fprintf(out, "static lval lbaked_v%i = {.type = ", id);
+  switch (v->type) {
+  case LVAL_NUM:
+    if (v->num == LONG_MIN) {
+      fputs("LVAL_NUM, .num = LONG_MIN", out);
+    } else {
+      fprintf(out, "LVAL_NUM, .num = %ldL", v->num);
+    }
+    break;
+  case LVAL_BIGNUM:
+    fprintf(out, "LVAL_BIGNUM, .big = {%i, %i, lbaked_l%i}", v->big.sign,
+            v->big.count, id);
+    break;
+  case LVAL_DBL:
+    if (v->dbl != v->dbl) {
+      fputs("LVAL_DBL, .dbl = NAN", out);
+    } else if (v->dbl == HUGE_VAL || v->dbl == -HUGE_VAL) {
+      fprintf(out, "LVAL_DBL, .dbl = %sHUGE_VAL", v->dbl < 0 ? "-" : "");
+    } else {
+      fprintf(out, "LVAL_DBL, .dbl = %a", v->dbl);
+    }
+    break;
+  case LVAL_SYM:
+    fprintf(out, "LVAL_SYM, .sym = lbaked_t%i", cells);
+    break;
+  case LVAL_STR:
+    fprintf(out, "LVAL_STR, .str = lbaked_t%i", cells);
+    break;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    fprintf(out, "%s, .count = %i, .cell = lbaked_c%i",
+            v->type == LVAL_SEXPR ? "LVAL_SEXPR" : "LVAL_QEXPR", v->count,
+            cells);
+    break;
+  }
+  fputs("};\n", out);
+  return id;
+}
+
+/* write the forms of a source file as C, for -DLISPY_BAKED_PRELUDE */
+lval *lbake_file(const char *filename, const char *path) {
+  lfile file;
+  if (!lfile_open(&file, filename)) {
+    return lval_err("Could not load library %s: Unable to open file!",
+                    filename);
+  }
+  lreader r;
+  lreader_init(&r, filename, file.data, file.len);
+  lval *forms = lval_read_all(&r);
+  lreader_free(&r);
+  uint64_t hash = lcache_hash(file.data, file.len);
+  long len = file.len;
+  lfile_close(&file);
+  if (forms->type == LVAL_ERR) {
+    lval *err = lval_err("Could not load library %s", forms->err);
+    lval_del(forms);
+    return err;
+  }
+
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    lval_del(forms);
+    return lval_err("Could not write %s", path);
+  }
+  lbake b = {out, 0, NULL, 0};
+  fprintf(out, "/* generated by lispyc --emit-c from %s, do not edit */\n\n",
+          filename);
+  int *ids = malloc(sizeof(int) * (forms->count ? forms->count : 1));
+  for (int i = 0; i < forms->count; i++) {
+    ids[i] = lbake_emit(&b, forms->cell[i]);
+  }
+  fputs("\nstatic lval *lbaked_prelude[] = {\n", out);
+  for (int i = 0; i < forms->count; i++) {
+    fprintf(out, "    &lbaked_v%i,\n", ids[i]);
+  }
+  fputs(forms->count ? "" : "    NULL,\n", out);
+  fprintf(out, "};\nstatic int lbaked_prelude_count = %i;\n", forms->count);
+  /* the file is recognised by its contents, or by its name when missing */
+  fprintf(out, "static uint64_t lbaked_prelude_hash = 0x%llxULL;\n",
+          (unsigned long long)hash);
+  fprintf(out, "static long lbaked_prelude_len = %li;\n", len);
+  const char *base = strrchr(filename, '/');
+  fputs("static char lbaked_prelude_name[] = ", out);
+  lbake_string(out, base ? base + 1 : filename);
+  fputs(";\n", out);
+  free(ids);
+  free(b.texts);
+  lval_del(forms);
+
+  if (fclose(out) != 0) {
+    return lval_err("Could not write %s", path);
+  }
+  return lval_sexpr();
+}
+
+#ifdef LISPY_BAKED_PRELUDE
+/* evaluate the prelude compiled into the binary */
+void lbaked_prelude_eval(lenv *e) {
+  lbaked_prelude_done = 1;
+  for (int i = 0; i < lbaked_prelude_count; i++) {
+    lval_eval_form(e, lval_copy(lbaked_prelude[i]));
+  }
+}
+
+/* whether a source is the baked prelude and that already ran, so
+ * loading it would define everything twice */
+int lbaked_prelude_loaded(uint64_t hash, long len) {
+  return lbaked_prelude_done && hash == lbaked_prelude_hash &&
+         len == lbaked_prelude_len;
+}
+
+/* whether a path names the file the prelude was baked from */
+int lbaked_prelude_named(const char *path) {
+  const char *base = strrchr(path, '/');
+  return strcmp(base ? base + 1 : path, lbaked_prelude_name) == 0;
+}
+#endif
+
+lval *lval_copy(lval *v) {
+  lval *x = malloc(sizeof(lval));
+  x->type = v->type;
+
+  switch (v->type) {
+  /* copy functions and numbers directly */
+  case LVAL_FUN:
+    if (v->builtin) {
+      x->builtin = v->builtin;
+    } else {
+      x->builtin = NULL;
+      x->env = lenv_copy(v->env);
+      x->formals = lval_copy(v->formals);
+      x->body = lval_copy(v->body);
+    }
+    break;
+  case LVAL_NUM:
+    x->num = v->num;
+    break;
+  case LVAL_BIGNUM:
+    x->big = lbig_copy(v->big);
+    break;
+  case LVAL_DBL:
+    x->dbl = v->dbl;
+    break;
+
+  /* copy strings using malloc and strcpy */
+  case LVAL_ERR:
+    x->err = malloc(strlen(v->err) + 1);
+    strcpy(x->err, v->err);
+    break;
+  case LVAL_SYM:
+    x->sym = malloc(strlen(v->sym) + 1);
+    strcpy(x->sym, v->sym);
+    break;
+  case LVAL_STR:
+    x->str = malloc(strlen(v->str) + 1);
+    strcpy(x->str, v->str);
+    break;
+
+  /* copy vectors as one block */
+  case LVAL_I64VEC:
+    x->count = v->count;
+    x->i64 = malloc(sizeof(int64_t) * (v->count ? v->count : 1));
+    memcpy(x->i64, v->i64, sizeof(int64_t) * v->count);
+    break;
+  case LVAL_F64VEC:
+    x->count = v->count;
+    x->f64 = malloc(sizeof(double) * (v->count ? v->count : 1));
+    memcpy(x->f64, v->f64, sizeof(double) * v->count);
+    break;
+
+  /* copy lists by copying each sub-expression */
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    x->count = v->count;
+    x->cell = malloc(sizeof(lval *) * x->count);
+    for (int i = 0; i < x->count; i++) {
+      x->cell[i] = lval_copy(v->cell[i]);
+    }
+    break;
+  }
+  return x;
+}
+
+lval *lval_add(lval *v, lval *x) {
+  v->count++;
+  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+  v->cell[v->count - 1] = x;
+  return v;
+}
+
+/*
+ * Output
+ *
+ * Everything printed to stdout collects in one growable buffer and goes
+ * out in a single write when it is flushed. A top level print flushes
+ * straight away when stdout is a terminal, otherwise only once
+ * LOUT_FLUSH bytes have built up, before waiting for input and at exit.
+ */
+
+#define LOUT_FLUSH (64L << 10)
+
+static lbuf lout = {NULL, 0, 0};
+
+void lout_flush(void) {
+  /* anything printed through stdio goes first */
+  fflush(stdout);
+#ifdef LISPY_MMAP
+  long done = 0;
+  while (done < lout.len) {
+    ssize_t n = write(STDOUT_FILENO, lout.data + done, lout.len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+#else
+  fwrite(lout.data, 1, lout.len, stdout);
+  fflush(stdout);
+#endif
+  lout.len = 0;
+}
+
+/* the end of a top level print */
+void lout_done(void) {
+  static int tty = -1;
+  if (tty < 0) {
+#ifdef LISPY_MMAP
+    tty = isatty(STDOUT_FILENO);
+#else
+    tty = 0;
+#endif
+  }
+  if (tty || lout.len >= LOUT_FLUSH) {
+    lout_flush();
+  }
+}
+
+void lout_byte(int c) { lbuf_byte(&lout, c); }
+
+/*
+ * Showing values
+ *
+ * lval_show writes the printed form of a value to o and returns its
+ * length, or only works out the length when o is NULL. Asking for the
+ * length first lets the whole form be written into one allocation,
+ * which is how show builds its string and how lval_print writes into
+ * the output buffer.
+ */
+
+/* where to write the part of a form n bytes in */
+#define LSHOW_AT(o, n) ((o) ? (o) + (n) : NULL)
+
+/* x in decimal, at least width digits */
+static long lshow_uint(char *o, unsigned long long x, int width) {
+  int n = 1;
+  for (unsigned long long y = x; y >= 10; y /= 10) {
+    n++;
+  }
+  n = n > width ? n : width;
+  if (o) {
+    for (int i = n - 1; i >= 0; i--) {
+      o[i] = (char)('0' + x % 10);
+      x /= 10;
+    }
+  }
+  return n;
+}
+
+static long lshow_int(char *o, long long x) {
+  if (x >= 0) {
+    return lshow_uint(o, (unsigned long long)x, 1);
+  }
+  if (o) {
+    *o++ = '-';
+  }
+  return 1 + lshow_uint(o, 0ULL - (unsigned long long)x, 1);
+}
+
+static long lshow_text(char *o, const char *s) {
+  long n = strlen(s);
+  if (o) {
+    memcpy(o, s, n);
+  }
+  return n;
+}
+
+/* the letter c is escaped with, the same escapes as mpcf_escape, or 0 */
+static char lshow_escape(char c) {
+  switch (c) {
+  case '\a':
+    return 'a';
+  case '\b':
+    return 'b';
+  case '\f':
+    return 'f';
+  case '\n':
+    return 'n';
+  case '\r':
+    return 'r';
+  case '\t':
+    return 't';
+  case '\v':
+    return 'v';
+  case '\\':
+  case '\'':
+  case '"':
+    return c;
+  default:
+    return 0;
+  }
+}
+
+static long lval_show_str(char *o, const char *s) {
+  long n = 2;
+  for (const char *p = s; *p; p++) {
+    n += lshow_escape(*p) ? 2 : 1;
+  }
+  if (o) {
+    *o++ = '"';
+    for (; *s; s++) {
+      char c = lshow_escape(*s);
+      if (c) {
+        *o++ = '\\';
+        *o++ = c;
+      } else {
+        *o++ = *s;
+      }
+    }
+    *o = '"';
+  }
+  return n;
+}
+
+static long lval_show_expr(lval *v, char open, char close, char *o) {
+  long n = 0;
+  if (o) {
+    o[n] = open;
+  }
+  n++;
+  for (int i = 0; i < v->count; i++) {
+    if (i) {
+      if (o) {
+        o[n] = ' ';
+      }
+      n++;
+    }
+    n += lval_show(v->cell[i], LSHOW_AT(o, n));
+  }
+  if (o) {
+    o[n] = close;
+  }
+  return n + 1;
+}
+
+static long lval_show_vec(lval *v, char *o) {
+  long n = 0;
+  if (o) {
+    o[n] = '[';
+  }
+  n++;
+  for (int i = 0; i < v->count; i++) {
+    if (i) {
+      if (o) {
+        o[n] = ' ';
+      }
+      n++;
+    }
+    if (v->type == LVAL_I64VEC) {
+      n += lshow_int(LSHOW_AT(o, n), v->i64[i]);
+    } else {
+      n += lval_show_dbl(v->f64[i], LSHOW_AT(o, n));
+    }
+  }
+  if (o) {
+    o[n] = ']';
+  }
+  return n + 1;
+}
+
+long lval_show(lval *v, char *o) {
+  long n;
+  switch (v->type) {
+  case LVAL_NUM:
+    return lshow_int(o, v->num);
+  case LVAL_BIGNUM:
+    return lval_show_big(v, o);
+  case LVAL_DBL:
+    return lval_show_dbl(v->dbl, o);
+  case LVAL_ERR:
+    n = lshow_text(o, "Error: ");
+    return n + lshow_text(LSHOW_AT(o, n), v->err);
+  case LVAL_SYM:
+    return lshow_text(o, v->sym);
+  case LVAL_STR:
+    return lval_show_str(o, v->str);
+  case LVAL_SEXPR:
+    return lval_show_expr(v, '(', ')', o);
+  case LVAL_QEXPR:
+    return lval_show_expr(v, '{', '}', o);
+  case LVAL_I64VEC:
+  case LVAL_F64VEC:
+    return lval_show_vec(v, o);
+  case LVAL_FUN:
+    if (v->builtin) {
+      return lshow_text(o, "<builtin>");
+    }
+    n = lshow_text(o, "(\\ ");
+    n += lval_show(v->formals, LSHOW_AT(o, n));
+    n += lshow_text(LSHOW_AT(o, n), " ");
+    n += lval_show(v->body, LSHOW_AT(o, n));
+    return n + lshow_text(LSHOW_AT(o, n), ")");
+  }
+  return 0;
+}
+
+void lval_print(lenv *e, lval *v) {
+  long n = lval_show(v, NULL);
+  lbuf_reserve(&lout, n);
+  lval_show(v, lout.data + lout.len);
+  lout.len += n;
+}
+
+void lval_println(lenv *e, lval *v) {
+  lval_print(e, v);
+  lout_byte('\n');
+  lout_done();
+}
+
+void lval_del(lval *v) {
+  switch (v->type) {
+  case LVAL_NUM:
+  case LVAL_DBL:
+    break;
+  case LVAL_BIGNUM:
+    free(v->big.limb);
+    break;
+  case LVAL_ERR:
     free(v->err);
     break;
   case LVAL_SYM:
@@ -667,140 +3298,760 @@ void lval_del(lval *v) {
     }
     free(v->cell);
     break;
+  case LVAL_I64VEC:
+    free(v->i64);
+    break;
+  case LVAL_F64VEC:
+    free(v->f64);
+    break;
+  }
+  free(v);
+}
+lval *lval_num(long x) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_NUM;
+  v->num = x;
+  return v;
+}
+
+lval *lval_dbl(double x) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_DBL;
+  v->dbl = x;
+  return v;
+}
+
+lval *lval_str(char *s) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_STR;
+  v->str = malloc(strlen(s) + 1);
+  strcpy(v->str, s);
+  return v;
+}
+
+lval *lval_err(char *fmt, ...) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_ERR;
+
+  /* create a va list and initialize it */
+  va_list va;
+  va_start(va, fmt);
+
+  /* TODO: what if we create bigger err messages
+   * is it possible that the user produces buffer overflow
+   * with symbol names?
+   * */
+  /* allocate 512 bytes of space */
+  v->err = malloc(512);
+
+  /* prinf the error string with a maximum of 511 characters */
+  vsnprintf(v->err, 511, fmt, va);
+
+  /* reallocate to number of bytes actually used */
+  v->err = realloc(v->err, strlen(v->err) + 1);
+
+  /* cleanup our va list */
+  va_end(va);
+
+  return v;
+}
+
+lval *lval_sym(char *s) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_SYM;
+  v->sym = malloc(strlen(s) + 1);
+  strcpy(v->sym, s);
+  return v;
+}
+
+lval *lval_sym_n(const char *s, long len) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_SYM;
+  v->sym = malloc(len + 1);
+  memcpy(v->sym, s, len);
+  v->sym[len] = '\0';
+  return v;
+}
+
+lval *lval_sexpr(void) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_SEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+lval *lval_qexpr(void) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_QEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+lval *lval_fun(lbuiltin func) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_FUN;
+  v->builtin = func;
+  return v;
+}
+
+lval *lval_lambda(lval *formals, lval *body) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_FUN;
+
+  // set builtin to null
+  v->builtin = NULL;
+
+  // build new env
+  v->env = lenv_new();
+
+  // set formula and body
+  v->formals = formals;
+  v->body = body;
+  return v;
+}
+
+lval *lval_pop(lval *v, int i) {
+  /* find the item at i */
+  lval *x = v->cell[i];
+
+  /* shift memory after the item at i over the top */
+  memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
+
+  /* decrease the count of items in the list */
+  v->count--;
+
+  /* Reallocate the memory used */
+  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+  return x;
+}
+
+lval *lval_take(lenv *e, lval *v, int i) {
+  lval *x = lval_pop(v, i);
+  lval_del(v);
+  return x;
+}
+
+/* overflow checked arithmetic on longs, returns non zero on overflow */
+#if defined(__GNUC__) || defined(__clang__)
+#define lnum_add(x, y, r) __builtin_add_overflow(x, y, r)
+#define lnum_sub(x, y, r) __builtin_sub_overflow(x, y, r)
+#define lnum_mul(x, y, r) __builtin_mul_overflow(x, y, r)
+#else
+static int lnum_add(long x, long y, long *r) {
+  if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y)) {
+    return 1;
+  }
+  *r = x + y;
+  return 0;
+}
+
+static int lnum_sub(long x, long y, long *r) {
+  if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y)) {
+    return 1;
+  }
+  *r = x - y;
+  return 0;
+}
+
+static int lnum_mul(long x, long y, long *r) {
+  if (x != 0 && y != 0 &&
+      ((x == -1 && y == LONG_MIN) || (y == -1 && x == LONG_MIN) ||
+       (x != -1 && y != -1 && (x * y) / y != x))) {
+    return 1;
+  }
+  *r = x * y;
+  return 0;
+}
+#endif
+
+/* arbitrary precision integers, numbers are promoted to these on overflow
+ * and demoted back to a plain long as soon as a result fits again */
+#define LBIG_BASE 4294967296ULL
+#define LBIG_KARATSUBA_MIN 32
+#define LBIG_DEC_CHUNK 1000000000U
+
+static int lbig_trim(const uint32_t *d, int n) {
+  while (n > 0 && d[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/* view a long, or any int64_t, as a bignum, buf must hold two limbs */
+static lbig lbig_from_long(int64_t x, uint32_t *buf) {
+  lbig b;
+  uint64_t m = x < 0 ? 0ULL - (uint64_t)x : (uint64_t)x;
+  b.sign = x < 0 ? -1 : 1;
+  b.count = 0;
+  b.limb = buf;
+  while (m) {
+    buf[b.count++] = (uint32_t)m;
+    m >>= 32;
+  }
+  return b;
+}
+
+/* view an integer lval as a bignum without copying */
+static lbig lval_to_lbig(lval *v, uint32_t *buf) {
+  if (v->type == LVAL_BIGNUM) {
+    return v->big;
+  }
+  return lbig_from_long(v->num, buf);
+}
+
+lbig lbig_copy(lbig x) {
+  lbig r = x;
+  r.limb = malloc(sizeof(uint32_t) * (x.count ? x.count : 1));
+  memcpy(r.limb, x.limb, sizeof(uint32_t) * x.count);
+  return r;
+}
+
+static int lbig_cmp_mag(const uint32_t *a, int an, const uint32_t *b, int bn) {
+  if (an != bn) {
+    return an > bn ? 1 : -1;
+  }
+  for (int i = an - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] > b[i] ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+int lbig_cmp(lbig x, lbig y) {
+  if (x.count == 0 && y.count == 0) {
+    return 0;
   }
-  free(v);
+  if (x.count == 0) {
+    return -y.sign;
+  }
+  if (y.count == 0 || x.sign != y.sign) {
+    return x.sign;
+  }
+  return x.sign * lbig_cmp_mag(x.limb, x.count, y.limb, y.count);
 }
-lval *lval_num(long x) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
-  v->num = x;
-  return v;
+
+/* r = a + b, r needs max(an, bn) + 1 limbs, returns the used limbs */
+static int lbig_add_mag(const uint32_t *a, int an, const uint32_t *b, int bn,
+                        uint32_t *r) {
+  if (an < bn) {
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    int tn = an;
+    an = bn;
+    bn = tn;
+  }
+  uint64_t carry = 0;
+  int i = 0;
+  for (; i < bn; i++) {
+    carry += (uint64_t)a[i] + b[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; i < an; i++) {
+    carry += a[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  r[i] = (uint32_t)carry;
+  return lbig_trim(r, an + 1);
 }
 
-lval *lval_str(char *s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
-  v->str = malloc(strlen(s) + 1);
-  strcpy(v->str, s);
-  return v;
+/* r = a - b where a >= b, r needs an limbs, returns the used limbs */
+static int lbig_sub_mag(const uint32_t *a, int an, const uint32_t *b, int bn,
+                        uint32_t *r) {
+  int64_t borrow = 0;
+  for (int i = 0; i < an; i++) {
+    borrow += (int64_t)a[i] - (i < bn ? b[i] : 0);
+    r[i] = (uint32_t)borrow;
+    borrow = borrow < 0 ? -1 : 0;
+  }
+  return lbig_trim(r, an);
 }
 
-lval *lval_err(char *fmt, ...) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+/* r = a * b by long multiplication, r needs an + bn limbs */
+static void lbig_mul_school(const uint32_t *a, int an, const uint32_t *b,
+                            int bn, uint32_t *r) {
+  memset(r, 0, sizeof(uint32_t) * (an + bn));
+  for (int i = 0; i < an; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < bn; j++) {
+      carry += (uint64_t)a[i] * b[j] + r[i + j];
+      r[i + j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    r[i + bn] = (uint32_t)carry;
+  }
+}
 
-  /* create a va list and initialize it */
-  va_list va;
-  va_start(va, fmt);
+/* r += a at limb offset, r must be large enough to absorb the carry */
+static void lbig_add_at(uint32_t *r, const uint32_t *a, int an) {
+  uint64_t carry = 0;
+  int i = 0;
+  for (; i < an; i++) {
+    carry += (uint64_t)r[i] + a[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; carry; i++) {
+    carry += r[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
 
-  /* TODO: what if we create bigger err messages
-   * is it possible that the user produces buffer overflow
-   * with symbol names?
-   * */
-  /* allocate 512 bytes of space */
-  v->err = malloc(512);
+/* r = a * b, r needs an + bn limbs, Karatsuba once both are large */
+static void lbig_mul_mag(const uint32_t *a, int an, const uint32_t *b, int bn,
+                         uint32_t *r) {
+  if (an < bn) {
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    int tn = an;
+    an = bn;
+    bn = tn;
+  }
+  if (bn < LBIG_KARATSUBA_MIN) {
+    lbig_mul_school(a, an, b, bn, r);
+    return;
+  }
 
-  /* prinf the error string with a maximum of 511 characters */
-  vsnprintf(v->err, 511, fmt, va);
+  int m = an / 2;
+  memset(r, 0, sizeof(uint32_t) * (an + bn));
+
+  /* b too short to split: r = a0 * b + a1 * b * B^m */
+  if (bn <= m) {
+    uint32_t *t = malloc(sizeof(uint32_t) * (an - m + bn));
+    lbig_mul_mag(a, m, b, bn, t);
+    memcpy(r, t, sizeof(uint32_t) * (m + bn));
+    lbig_mul_mag(a + m, an - m, b, bn, t);
+    lbig_add_at(r + m, t, lbig_trim(t, an - m + bn));
+    free(t);
+    return;
+  }
 
-  /* reallocate to number of bytes actually used */
-  v->err = realloc(v->err, strlen(v->err) + 1);
+  /* z0 = a0 * b0, z2 = a1 * b1, z1 = (a0 + a1) * (b0 + b1) - z0 - z2 */
+  int a1n = an - m;
+  int b1n = bn - m;
+  uint32_t *z0 = malloc(sizeof(uint32_t) * 2 * m);
+  uint32_t *z2 = malloc(sizeof(uint32_t) * (a1n + b1n));
+  uint32_t *sa = malloc(sizeof(uint32_t) * (a1n + 1));
+  uint32_t *sb = malloc(sizeof(uint32_t) * (a1n + 1));
+  uint32_t *z1 = malloc(sizeof(uint32_t) * 2 * (a1n + 1));
+
+  int z0n = 2 * m;
+  int z2n = a1n + b1n;
+  lbig_mul_mag(a, m, b, m, z0);
+  lbig_mul_mag(a + m, a1n, b + m, b1n, z2);
+  z0n = lbig_trim(z0, z0n);
+  z2n = lbig_trim(z2, z2n);
+
+  int san = lbig_add_mag(a, lbig_trim(a, m), a + m, a1n, sa);
+  int sbn = lbig_add_mag(b, lbig_trim(b, m), b + m, b1n, sb);
+  int z1n = san + sbn;
+  if (san && sbn) {
+    lbig_mul_mag(sa, san, sb, sbn, z1);
+  } else {
+    z1n = 0;
+  }
+  z1n = lbig_trim(z1, z1n);
+  z1n = lbig_sub_mag(z1, z1n, z0, z0n, z1);
+  z1n = lbig_sub_mag(z1, z1n, z2, z2n, z1);
+
+  memcpy(r, z0, sizeof(uint32_t) * z0n);
+  memcpy(r + 2 * m, z2, sizeof(uint32_t) * z2n);
+  lbig_add_at(r + m, z1, z1n);
+
+  free(z0);
+  free(z1);
+  free(z2);
+  free(sa);
+  free(sb);
+}
 
-  /* cleanup our va list */
-  va_end(va);
+/* q = a / b for an >= bn >= 2 using Knuth's algorithm D,
+ * q needs an - bn + 1 limbs */
+static void lbig_div_knuth(const uint32_t *u, int m, const uint32_t *v, int n,
+                           uint32_t *q) {
+  /* normalize so the top bit of the divisor is set */
+  int s = 0;
+  for (uint32_t top = v[n - 1]; !(top & 0x80000000U); top <<= 1) {
+    s++;
+  }
+  uint32_t *vn = malloc(sizeof(uint32_t) * n);
+  uint32_t *un = malloc(sizeof(uint32_t) * (m + 1));
+  for (int i = n - 1; i > 0; i--) {
+    vn[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+  }
+  vn[0] = v[0] << s;
+  un[m] = s ? u[m - 1] >> (32 - s) : 0;
+  for (int i = m - 1; i > 0; i--) {
+    un[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+  }
+  un[0] = u[0] << s;
+
+  for (int j = m - n; j >= 0; j--) {
+    /* estimate the quotient digit from the top two limbs */
+    uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+    uint64_t qhat = num / vn[n - 1];
+    uint64_t rhat = num % vn[n - 1];
+    while (qhat >= LBIG_BASE ||
+           qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+      qhat--;
+      rhat += vn[n - 1];
+      if (rhat >= LBIG_BASE) {
+        break;
+      }
+    }
 
-  return v;
+    /* multiply and subtract */
+    int64_t k = 0;
+    int64_t t;
+    for (int i = 0; i < n; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xFFFFFFFFU);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + n] - k;
+    un[j + n] = (uint32_t)t;
+
+    /* estimate was one too large, add back */
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      uint64_t c = 0;
+      for (int i = 0; i < n; i++) {
+        c += (uint64_t)un[i + j] + vn[i];
+        un[i + j] = (uint32_t)c;
+        c >>= 32;
+      }
+      un[j + n] += (uint32_t)c;
+    }
+  }
+  free(vn);
+  free(un);
 }
 
-lval *lval_sym(char *s) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
-  return v;
+/* d = d / s in place, returns the remainder */
+static uint32_t lbig_div_small(uint32_t *d, int n, uint32_t s) {
+  uint64_t rem = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    uint64_t cur = (rem << 32) | d[i];
+    d[i] = (uint32_t)(cur / s);
+    rem = cur % s;
+  }
+  return (uint32_t)rem;
 }
 
-lval *lval_read_str(mpc_ast_t* t) {
-  /*   cut off the final quote character */
-  t->contents[strlen(t->contents) -1] = '\0';
-  /*   copy the string missing out the first quote character  */
-  char* unescaped = malloc(strlen(t->contents+1) +1);
-  strcpy(unescaped, t->contents+1);
-  /*   pass through the unescape function */
-  unescaped = mpcf_unescape(unescaped);
-  /*   construct a new lval using the string */
-  lval* str = lval_str(unescaped);
-  free(unescaped);
-  return str;
+static lbig lbig_add(lbig x, lbig y) {
+  lbig r;
+  int n = (x.count > y.count ? x.count : y.count) + 1;
+  r.limb = malloc(sizeof(uint32_t) * n);
+  if (x.sign == y.sign) {
+    r.sign = x.sign;
+    r.count = lbig_add_mag(x.limb, x.count, y.limb, y.count, r.limb);
+  } else if (lbig_cmp_mag(x.limb, x.count, y.limb, y.count) >= 0) {
+    r.sign = x.sign;
+    r.count = lbig_sub_mag(x.limb, x.count, y.limb, y.count, r.limb);
+  } else {
+    r.sign = y.sign;
+    r.count = lbig_sub_mag(y.limb, y.count, x.limb, x.count, r.limb);
+  }
+  if (r.count == 0) {
+    r.sign = 1;
+  }
+  return r;
 }
 
-lval *lval_sexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+static lbig lbig_sub(lbig x, lbig y) {
+  y.sign = -y.sign;
+  return lbig_add(x, y);
 }
 
-lval *lval_qexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+static lbig lbig_mul(lbig x, lbig y) {
+  lbig r;
+  r.sign = x.sign * y.sign;
+  r.limb = malloc(sizeof(uint32_t) * (x.count + y.count + 1));
+  if (x.count == 0 || y.count == 0) {
+    r.count = 0;
+  } else {
+    lbig_mul_mag(x.limb, x.count, y.limb, y.count, r.limb);
+    r.count = lbig_trim(r.limb, x.count + y.count);
+  }
+  if (r.count == 0) {
+    r.sign = 1;
+  }
+  return r;
 }
 
-lval *lval_fun(lbuiltin func) {
+/* truncating division like C, y must not be zero */
+static lbig lbig_div(lbig x, lbig y) {
+  lbig r;
+  r.sign = x.sign * y.sign;
+  r.limb = malloc(sizeof(uint32_t) * (x.count + 1));
+  if (lbig_cmp_mag(x.limb, x.count, y.limb, y.count) < 0) {
+    r.count = 0;
+  } else if (y.count == 1) {
+    memcpy(r.limb, x.limb, sizeof(uint32_t) * x.count);
+    lbig_div_small(r.limb, x.count, y.limb[0]);
+    r.count = lbig_trim(r.limb, x.count);
+  } else {
+    lbig_div_knuth(x.limb, x.count, y.limb, y.count, r.limb);
+    r.count = lbig_trim(r.limb, x.count - y.count + 1);
+  }
+  if (r.count == 0) {
+    r.sign = 1;
+  }
+  return r;
+}
+
+/* takes ownership of b, demoting it to a plain number when it fits */
+lval *lval_bignum(lbig b) {
+  if (b.count <= (int)(sizeof(long) / sizeof(uint32_t))) {
+    unsigned long m = 0;
+    for (int i = b.count - 1; i >= 0; i--) {
+      m = (m << 16 << 16) | b.limb[i];
+    }
+    if (b.sign > 0 && m <= (unsigned long)LONG_MAX) {
+      free(b.limb);
+      return lval_num((long)m);
+    }
+    if (b.sign < 0 && m - 1 <= (unsigned long)LONG_MAX) {
+      free(b.limb);
+      return lval_num(-(long)(m - 1) - 1);
+    }
+  }
   lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->builtin = func;
+  v->type = LVAL_BIGNUM;
+  v->big = b;
   return v;
 }
 
-lval *lval_lambda(lval *formals, lval *body) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+/* parse an optionally signed string of decimal digits of any length */
+lval *lval_read_big(char *s) {
+  lbig b;
+  b.sign = 1;
+  if (*s == '-') {
+    b.sign = -1;
+    s++;
+  }
+  int digits = strlen(s);
+  b.limb = malloc(sizeof(uint32_t) * (digits / 9 + 2));
+  b.count = 0;
+
+  /* fold in the digits nine at a time, most significant first */
+  int chunk = digits % 9 ? digits % 9 : 9;
+  while (*s) {
+    uint32_t part = 0;
+    for (int i = 0; i < chunk; i++) {
+      part = part * 10 + (uint32_t)(*s++ - '0');
+    }
+    uint32_t scale = 1;
+    for (int i = 0; i < chunk; i++) {
+      scale *= 10;
+    }
+    uint64_t carry = part;
+    for (int i = 0; i < b.count; i++) {
+      carry += (uint64_t)b.limb[i] * scale;
+      b.limb[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      b.limb[b.count++] = (uint32_t)carry;
+    }
+    chunk = 9;
+  }
+  if (b.count == 0) {
+    b.sign = 1;
+  }
+  return lval_bignum(b);
+}
 
-  // set builtin to null
-  v->builtin = NULL;
+long lval_show_big(lval *v, char *o) {
+  lbig b = lbig_copy(v->big);
 
-  // build new env
-  v->env = lenv_new();
+  /* peel off base 10^9 chunks, least significant first */
+  uint32_t *chunks = malloc(sizeof(uint32_t) * (b.count * 10 / 9 + 2));
+  int n = 0;
+  while (b.count) {
+    chunks[n++] = lbig_div_small(b.limb, b.count, LBIG_DEC_CHUNK);
+    b.count = lbig_trim(b.limb, b.count);
+  }
 
-  // set formula and body
-  v->formals = formals;
-  v->body = body;
-  return v;
+  long len = 0;
+  if (v->big.sign < 0) {
+    if (o) {
+      o[len] = '-';
+    }
+    len++;
+  }
+  len += lshow_uint(LSHOW_AT(o, len), n ? chunks[n - 1] : 0, 1);
+  for (int i = n - 2; i >= 0; i--) {
+    len += lshow_uint(LSHOW_AT(o, len), chunks[i], 9);
+  }
+  free(chunks);
+  free(b.limb);
+  return len;
 }
 
-lval *lval_pop(lval *v, int i) {
-  /* find the item at i */
-  lval *x = v->cell[i];
+double lbig_to_dbl(lbig b) {
+  double d = 0;
+  for (int i = b.count - 1; i >= 0; i--) {
+    d = d * 4294967296.0 + b.limb[i];
+  }
+  return b.sign * d;
+}
 
-  /* shift memory after the item at i over the top */
-  memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
+int lval_is_number(lval *v) {
+  return v->type == LVAL_NUM || v->type == LVAL_BIGNUM || v->type == LVAL_DBL;
+}
 
-  /* decrease the count of items in the list */
-  v->count--;
+double lval_to_dbl(lval *v) {
+  switch (v->type) {
+  case LVAL_NUM:
+    return (double)v->num;
+  case LVAL_BIGNUM:
+    return lbig_to_dbl(v->big);
+  default:
+    return v->dbl;
+  }
+}
 
-  /* Reallocate the memory used */
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+long lval_show_dbl(double d, char *o) {
+  /* the sign printf gives a NaN depends on how it was made */
+  if (d != d) {
+    return lshow_text(o, "nan");
+  }
+  /* shortest precision from 15 digits up that reads back the same value */
+  char buf[32];
+  for (int prec = 15; prec <= 17; prec++) {
+    snprintf(buf, sizeof(buf), "%.*g", prec, d);
+    if (strtod(buf, NULL) == d) {
+      break;
+    }
+  }
+  /* keep a decimal point so it reads back as a double */
+  if (!strpbrk(buf, ".eEni")) {
+    strcat(buf, ".0");
+  }
+  return lshow_text(o, buf);
+}
+
+/* store a numeric result in the first argument and free the others */
+static lval *lval_reuse_num(lval *a, long r) {
+  lval *x = a->cell[0];
+  x->num = r;
+  a->cell[0] = a->cell[a->count - 1];
+  a->count--;
+  lval_del(a);
   return x;
 }
 
-lval *lval_take(lenv *e, lval *v, int i) {
-  lval *x = lval_pop(v, i);
-  lval_del(v);
+/* store a double result in the first argument and free the others */
+static lval *lval_reuse_dbl(lval *a, double r) {
+  lval *x = a->cell[0];
+  if (x->type == LVAL_BIGNUM) {
+    free(x->big.limb);
+  }
+  x->type = LVAL_DBL;
+  x->dbl = r;
+  a->cell[0] = a->cell[a->count - 1];
+  a->count--;
+  lval_del(a);
   return x;
 }
 
-lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
+/* true if a holds exactly two numbers, the shape of most arithmetic */
+static int lval_num_pair(lval *a) {
+  return a->count == 2 && a->cell[0]->type == LVAL_NUM &&
+         a->cell[1]->type == LVAL_NUM;
+}
+
+static int lval_dbl_pair(lval *a) {
+  return a->count == 2 && a->cell[0]->type == LVAL_DBL &&
+         a->cell[1]->type == LVAL_DBL;
+}
+
+lval *builtin_add(lenv *e, lval *a) {
+  long r;
+  if (lval_num_pair(a) && !lnum_add(a->cell[0]->num, a->cell[1]->num, &r)) {
+    return lval_reuse_num(a, r);
+  }
+  if (lval_dbl_pair(a)) {
+    return lval_reuse_dbl(a, a->cell[0]->dbl + a->cell[1]->dbl);
+  }
+  return builtin_op(e, a, LOP_ADD);
+}
+
+lval *builtin_sub(lenv *e, lval *a) {
+  long r;
+  if (lval_num_pair(a) && !lnum_sub(a->cell[0]->num, a->cell[1]->num, &r)) {
+    return lval_reuse_num(a, r);
+  }
+  if (lval_dbl_pair(a)) {
+    return lval_reuse_dbl(a, a->cell[0]->dbl - a->cell[1]->dbl);
+  }
+  return builtin_op(e, a, LOP_SUB);
+}
+
+lval *builtin_mul(lenv *e, lval *a) {
+  long r;
+  if (lval_num_pair(a) && !lnum_mul(a->cell[0]->num, a->cell[1]->num, &r)) {
+    return lval_reuse_num(a, r);
+  }
+  if (lval_dbl_pair(a)) {
+    return lval_reuse_dbl(a, a->cell[0]->dbl * a->cell[1]->dbl);
+  }
+  return builtin_op(e, a, LOP_MUL);
+}
+
+lval *builtin_div(lenv *e, lval *a) {
+  /* zero divisor and LONG_MIN / -1 are left to the checked path */
+  if (lval_num_pair(a) && a->cell[1]->num > 0) {
+    return lval_reuse_num(a, a->cell[0]->num / a->cell[1]->num);
+  }
+  if (lval_dbl_pair(a)) {
+    return lval_reuse_dbl(a, a->cell[0]->dbl / a->cell[1]->dbl);
+  }
+  return builtin_op(e, a, LOP_DIV);
+}
+
+/* fold a list of numbers with + or *, the list itself becomes the
+ * argument list so no intermediate values are created */
+static lval *builtin_fold_list(lenv *e, lval *a, char *func, int op) {
+  LASSERT_ARG_COUNT(a, func, 1);
+  if (a->cell[0]->type == LVAL_I64VEC || a->cell[0]->type == LVAL_F64VEC) {
+    return op == LOP_ADD ? builtin_vec_sum(e, a) : builtin_vec_product(e, a);
+  }
+  LASSERT_TYPE(a, func, 0, LVAL_QEXPR);
+
+  lval *q = a->cell[0];
+  for (int i = 0; i < q->count; i++) {
+    LASSERT(a, lval_is_number(q->cell[i]),
+            "Function '%s' passed incorrect type for element %i. "
+            "Got %s, Expected %s.",
+            func, i, ltype_name(q->cell[i]->type), ltype_name(LVAL_NUM));
+  }
 
-lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
+  q = lval_take(e, a, 0);
+  if (q->count == 0) {
+    lval_del(q);
+    return lval_num(op == LOP_ADD ? 0 : 1);
+  }
+  return builtin_op(e, q, op);
+}
 
-lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
+lval *builtin_sum(lenv *e, lval *a) {
+  return builtin_fold_list(e, a, "sum", LOP_ADD);
+}
 
-lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, "/"); }
+lval *builtin_product(lenv *e, lval *a) {
+  return builtin_fold_list(e, a, "product", LOP_MUL);
+}
 
 lval *builtin_def(lenv *e, lval *a) { return builtin_var(e, a, "def"); }
 
@@ -859,93 +4110,337 @@ lval *builtin_lambda(lenv *e, lval *a) {
   return lval_lambda(formals, body);
 }
 
-lval *builtin_op(lenv *e, lval *a, char *op) {
-  /* ensure all arguments are numbers  */
+static char *lop_name[] = {"+", "-", "*", "/"};
+
+/* continue an operation with bignums from argument i onwards,
+ * x holds the fixed width result of the arguments before i */
+static lval *builtin_op_big(lval *a, int op, long x, int i) {
+  uint32_t buf[2];
+  lbig acc;
+  if (i == 0) {
+    acc = lbig_copy(lval_to_lbig(a->cell[0], buf));
+    i = 1;
+  } else {
+    acc = lbig_copy(lbig_from_long(x, buf));
+  }
+
+  /* unary negation */
+  if (op == LOP_SUB && a->count == 1 && acc.count) {
+    acc.sign = -acc.sign;
+  }
+
+  for (; i < a->count; i++) {
+    lbig y = lval_to_lbig(a->cell[i], buf);
+    lbig r;
+    switch (op) {
+    case LOP_ADD:
+      r = lbig_add(acc, y);
+      break;
+    case LOP_SUB:
+      r = lbig_sub(acc, y);
+      break;
+    case LOP_MUL:
+      r = lbig_mul(acc, y);
+      break;
+    default:
+      if (y.count == 0) {
+        free(acc.limb);
+        lval_del(a);
+        return lval_err("Division by zero!");
+      }
+      r = lbig_div(acc, y);
+      break;
+    }
+    free(acc.limb);
+    acc = r;
+  }
+
+  lval_del(a);
+  return lval_bignum(acc);
+}
+
+/* an operation involving a double, done in doubles with IEEE semantics */
+static lval *builtin_op_dbl(lval *a, int op, int all_dbl) {
+  double x = lval_to_dbl(a->cell[0]);
+
+  /* all doubles is the common case, keep its loops free of conversions */
+  if (all_dbl) {
+    switch (op) {
+    case LOP_ADD:
+      for (int i = 1; i < a->count; i++) {
+        x += a->cell[i]->dbl;
+      }
+      break;
+    case LOP_SUB:
+      for (int i = 1; i < a->count; i++) {
+        x -= a->cell[i]->dbl;
+      }
+      break;
+    case LOP_MUL:
+      for (int i = 1; i < a->count; i++) {
+        x *= a->cell[i]->dbl;
+      }
+      break;
+    case LOP_DIV:
+      for (int i = 1; i < a->count; i++) {
+        x /= a->cell[i]->dbl;
+      }
+      break;
+    }
+  } else {
+    for (int i = 1; i < a->count; i++) {
+      double y = lval_to_dbl(a->cell[i]);
+      switch (op) {
+      case LOP_ADD:
+        x += y;
+        break;
+      case LOP_SUB:
+        x -= y;
+        break;
+      case LOP_MUL:
+        x *= y;
+        break;
+      case LOP_DIV:
+        x /= y;
+        break;
+      }
+    }
+  }
+
+  /* unary negation */
+  if (op == LOP_SUB && a->count == 1) {
+    x = -x;
+  }
+  return lval_reuse_dbl(a, x);
+}
+
+/* long argument lists are folded with four independent accumulators so
+ * the checked adds and multiplies overlap instead of forming one chain */
+#define LNUM_UNROLL_MIN 16
+
+/* sum of n numbers, non zero if any partial sum overflowed */
+static int lnum_sum_cells(lval **c, int n, long *r) {
+  long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  int overflow = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    overflow |= lnum_add(s0, c[i]->num, &s0);
+    overflow |= lnum_add(s1, c[i + 1]->num, &s1);
+    overflow |= lnum_add(s2, c[i + 2]->num, &s2);
+    overflow |= lnum_add(s3, c[i + 3]->num, &s3);
+  }
+  for (; i < n; i++) {
+    overflow |= lnum_add(s0, c[i]->num, &s0);
+  }
+  overflow |= lnum_add(s0, s1, &s0);
+  overflow |= lnum_add(s2, s3, &s2);
+  overflow |= lnum_add(s0, s2, r);
+  return overflow;
+}
+
+/* product of n numbers, non zero if any partial product overflowed */
+static int lnum_product_cells(lval **c, int n, long *r) {
+  long p0 = 1, p1 = 1, p2 = 1, p3 = 1;
+  int overflow = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    overflow |= lnum_mul(p0, c[i]->num, &p0);
+    overflow |= lnum_mul(p1, c[i + 1]->num, &p1);
+    overflow |= lnum_mul(p2, c[i + 2]->num, &p2);
+    overflow |= lnum_mul(p3, c[i + 3]->num, &p3);
+  }
+  for (; i < n; i++) {
+    overflow |= lnum_mul(p0, c[i]->num, &p0);
+  }
+  overflow |= lnum_mul(p0, p1, &p0);
+  overflow |= lnum_mul(p2, p3, &p2);
+  overflow |= lnum_mul(p0, p2, r);
+  return overflow;
+}
+
+lval *builtin_op(lenv *e, lval *a, int op) {
+  /* ensure all arguments are numbers, noting which kinds turn up */
   /* TODO: or symbols that generates/carries numbers */
+  int kinds = 0;
   for (int i = 0; i < a->count; i++) {
-    LASSERT_TYPE(a, "op", i, LVAL_NUM);
+    LASSERT(a, lval_is_number(a->cell[i]),
+            "Function '%s' passed incorrect type for argument %i. "
+            "Got %s, Expected %s.",
+            lop_name[op], i, ltype_name(a->cell[i]->type),
+            ltype_name(LVAL_NUM));
+    kinds |= 1 << a->cell[i]->type;
   }
+  LASSERT(a, a->count > 0, "Function '%s' passed no arguments!",
+          lop_name[op]);
 
-  /* pop the first element */
-  lval *x = lval_pop(a, 0);
-
-  /* if no arguments and sub then perform unary negation */
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->num = -x->num;
+  /* any double promotes the whole operation to doubles */
+  if (kinds & (1 << LVAL_DBL)) {
+    return builtin_op_dbl(a, op, kinds == 1 << LVAL_DBL);
+  }
+  if (kinds != 1 << LVAL_NUM) {
+    return builtin_op_big(a, op, 0, 0);
   }
 
-  /* while there are still elements remaining */
-  while (a->count > 0) {
-    /* pop the next element  */
-    lval *y = lval_pop(a, 0);
+  /* whole lists of numbers, a partial overflow redoes it exactly */
+  long x;
+  if (a->count >= LNUM_UNROLL_MIN && (op == LOP_ADD || op == LOP_MUL)) {
+    int overflow = op == LOP_ADD ? lnum_sum_cells(a->cell, a->count, &x)
+                                 : lnum_product_cells(a->cell, a->count, &x);
+    return overflow ? builtin_op_big(a, op, 0, 0) : lval_reuse_num(a, x);
+  }
 
-    if (strcmp(op, "+") == 0) {
-      x->num += y->num;
+  /* stay in fixed width until an overflow turns up,
+   * one loop per operator so the operator is only looked at once */
+  x = a->cell[0]->num;
+  long t;
+  int i = 1;
+  switch (op) {
+  case LOP_ADD:
+    for (; i < a->count; i++) {
+      if (lnum_add(x, a->cell[i]->num, &t)) {
+        break;
+      }
+      x = t;
     }
-    if (strcmp(op, "-") == 0) {
-      x->num -= y->num;
+    break;
+  case LOP_SUB:
+    /* if no arguments and sub then perform unary negation */
+    if (a->count == 1) {
+      if (lnum_sub(0, x, &t)) {
+        return builtin_op_big(a, op, 0, 0);
+      }
+      x = t;
     }
-    if (strcmp(op, "*") == 0) {
-      x->num *= y->num;
+    for (; i < a->count; i++) {
+      if (lnum_sub(x, a->cell[i]->num, &t)) {
+        break;
+      }
+      x = t;
     }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division by zero!");
+    break;
+  case LOP_MUL:
+    for (; i < a->count; i++) {
+      if (lnum_mul(x, a->cell[i]->num, &t)) {
+        break;
+      }
+      x = t;
+    }
+    break;
+  case LOP_DIV:
+    for (; i < a->count; i++) {
+      long y = a->cell[i]->num;
+      if (y == 0) {
+        lval_del(a);
+        return lval_err("Division by zero!");
+      }
+      if (x == LONG_MIN && y == -1) {
         break;
       }
-      x->num /= y->num;
+      x /= y;
+    }
+    break;
+  }
+
+  if (i < a->count) {
+    return builtin_op_big(a, op, x, i);
+  }
+  return lval_reuse_num(a, x);
+}
+
+static char *lord_name[] = {">", ">=", "<", "<="};
+
+lval *builtin_ord(lenv *e, lval *a, int op) {
+  LASSERT_ARG_COUNT(a, lord_name[op], 2);
+  for (int i = 0; i < 2; i++) {
+    LASSERT(a, lval_is_number(a->cell[i]),
+            "Function '%s' passed incorrect type for argument %i. "
+            "Got %s, Expected %s.",
+            lord_name[op], i, ltype_name(a->cell[i]->type),
+            ltype_name(LVAL_NUM));
+  }
+
+  /* compare as doubles if either is one, exactly otherwise */
+  int c;
+  if (a->cell[0]->type == LVAL_DBL || a->cell[1]->type == LVAL_DBL) {
+    double x = lval_to_dbl(a->cell[0]);
+    double y = lval_to_dbl(a->cell[1]);
+    c = (x > y) - (x < y);
+    /* NaN is unordered, every comparison is false */
+    if (x != x || y != y) {
+      lval_del(a);
+      return lval_num(0);
     }
-    lval_del(y);
+  } else {
+    uint32_t xbuf[2], ybuf[2];
+    c = lbig_cmp(lval_to_lbig(a->cell[0], xbuf),
+                 lval_to_lbig(a->cell[1], ybuf));
+  }
+  int r = 0;
+  switch (op) {
+  case LORD_GT:
+    r = c > 0;
+    break;
+  case LORD_GE:
+    r = c >= 0;
+    break;
+  case LORD_LT:
+    r = c < 0;
+    break;
+  case LORD_LE:
+    r = c <= 0;
+    break;
   }
   lval_del(a);
-  return x;
+  return lval_num(r);
 }
 
-lval *builtin_ord(lenv *e, lval *a, char *op) {
-  LASSERT_ARG_COUNT(a, "ord", 2);
-  LASSERT_TYPE(a, "ord", 0, LVAL_NUM);
-  LASSERT_TYPE(a, "ord", 1, LVAL_NUM);
-
-  int r;
-  if (strcmp(op, ">") == 0) {
-    r = (a->cell[0]->num > a->cell[1]->num);
+lval *builtin_gt(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num > a->cell[1]->num);
   }
-  if (strcmp(op, ">=") == 0) {
-    r = (a->cell[0]->num >= a->cell[1]->num);
+  return builtin_ord(e, a, LORD_GT);
+}
+
+lval *builtin_lt(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num < a->cell[1]->num);
   }
-  if (strcmp(op, "<") == 0) {
-    r = (a->cell[0]->num < a->cell[1]->num);
+  return builtin_ord(e, a, LORD_LT);
+}
+
+lval *builtin_ge(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num >= a->cell[1]->num);
   }
-  if (strcmp(op, "<=") == 0) {
-    r = (a->cell[0]->num <= a->cell[1]->num);
+  return builtin_ord(e, a, LORD_GE);
+}
+
+lval *builtin_le(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num <= a->cell[1]->num);
   }
+  return builtin_ord(e, a, LORD_LE);
+}
 
+lval *builtin_eq(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num == a->cell[1]->num);
+  }
+  LASSERT_ARG_COUNT(a, "==", 2);
+  int r = lval_eq(a->cell[0], a->cell[1]);
   lval_del(a);
   return lval_num(r);
 }
 
-lval *builtin_gt(lenv *e, lval *a) { return builtin_ord(e, a, ">"); }
-lval *builtin_lt(lenv *e, lval *a) { return builtin_ord(e, a, "<"); }
-lval *builtin_ge(lenv *e, lval *a) { return builtin_ord(e, a, ">="); }
-lval *builtin_le(lenv *e, lval *a) { return builtin_ord(e, a, "<="); }
-
-lval *builtin_cmp(lenv *e, lval *a, char *op) {
-  LASSERT_ARG_COUNT(a, "cmp", 2);
-  int r;
-  if (strcmp(op, "==") == 0) {
-    r = lval_eq(a->cell[0], a->cell[1]);
-  }
-  if (strcmp(op, "!=") == 0) {
-    r = !lval_eq(a->cell[0], a->cell[1]);
+lval *builtin_ne(lenv *e, lval *a) {
+  if (lval_num_pair(a)) {
+    return lval_reuse_num(a, a->cell[0]->num != a->cell[1]->num);
   }
+  LASSERT_ARG_COUNT(a, "!=", 2);
+  int r = !lval_eq(a->cell[0], a->cell[1]);
   lval_del(a);
   return lval_num(r);
 }
-lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, "=="); }
-
-lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, "!="); }
 
 lval *builtin_if(lenv *e, lval *a) {
   LASSERT_ARG_COUNT(a, "if", 3);
@@ -1114,6 +4609,12 @@ lval *lval_call(lenv *e, lval *f, lval *a) {
 }
 
 int lval_eq(lval *x, lval *y) {
+  /* doubles compare by value against the integer types */
+  if (x->type != y->type && (x->type == LVAL_DBL || y->type == LVAL_DBL) &&
+      lval_is_number(x) && lval_is_number(y)) {
+    return lval_to_dbl(x) == lval_to_dbl(y);
+  }
+
   /* different types are always unequal */
   if (x->type != y->type) {
     return 0;
@@ -1123,6 +4624,23 @@ int lval_eq(lval *x, lval *y) {
   switch (x->type) {
   case LVAL_NUM:
     return (x->num == y->num);
+  case LVAL_BIGNUM:
+    return lbig_cmp(x->big, y->big) == 0;
+  case LVAL_DBL:
+    return (x->dbl == y->dbl);
+  case LVAL_I64VEC:
+    return x->count == y->count &&
+           memcmp(x->i64, y->i64, sizeof(int64_t) * x->count) == 0;
+  case LVAL_F64VEC:
+    if (x->count != y->count) {
+      return 0;
+    }
+    for (int i = 0; i < x->count; i++) {
+      if (x->f64[i] != y->f64[i]) {
+        return 0;
+      }
+    }
+    return 1;
   case LVAL_ERR:
     return (strcmp(x->err, y->err) == 0);
   case LVAL_SYM:
@@ -1167,8 +4685,17 @@ lval *builtin(lenv *e, lval *a, char *func) {
   if (strcmp("eval", func) == 0) {
     return builtin_eval(e, a);
   }
-  if (strstr("+-/*", func)) {
-    return builtin_op(e, a, func);
+  if (strcmp("+", func) == 0) {
+    return builtin_add(e, a);
+  }
+  if (strcmp("-", func) == 0) {
+    return builtin_sub(e, a);
+  }
+  if (strcmp("*", func) == 0) {
+    return builtin_mul(e, a);
+  }
+  if (strcmp("/", func) == 0) {
+    return builtin_div(e, a);
   }
   lval_del(a);
   return lval_err("Unknown Function!");
@@ -1245,16 +4772,909 @@ lval *lval_join(lenv *e, lval *x, lval *y) {
   return x;
 }
 
-int number_of_nodes(mpc_ast_t *t) {
-  if (t->children_num == 0) {
-    return 1;
+/*
+ * Packed numeric vectors
+ *
+ * i64 and f64 vectors keep their elements in one contiguous array so
+ * bulk arithmetic runs over plain memory. The kernels come in scalar,
+ * SSE2 and AVX2 flavours, picked once at runtime from what the CPU
+ * supports.
+ *
+ * Unlike + and *, which promote to a bignum, elementwise i64 arithmetic
+ * has no room for an element that overflows, so vec+ and the others
+ * fail with an error instead. The reductions vec-sum, vec-product and
+ * vec-dot return a single number and do promote. The scalar operators
+ * don't take vectors at all. f64 sums add several lanes at once, so
+ * their rounding can differ between flavours.
+ */
+
+typedef struct {
+  /* elementwise, the i64 ones return non zero on overflow */
+  int (*i64_add)(int64_t *r, const int64_t *x, const int64_t *y, int n);
+  int (*i64_sub)(int64_t *r, const int64_t *x, const int64_t *y, int n);
+  void (*f64_add)(double *r, const double *x, const double *y, int n);
+  void (*f64_sub)(double *r, const double *x, const double *y, int n);
+  void (*f64_mul)(double *r, const double *x, const double *y, int n);
+  void (*f64_div)(double *r, const double *x, const double *y, int n);
+  /* reductions over n > 0 elements */
+  int (*i64_sum)(const int64_t *x, int n, int64_t *r);
+  int64_t (*i64_min)(const int64_t *x, int n);
+  int64_t (*i64_max)(const int64_t *x, int n);
+  double (*f64_sum)(const double *x, int n);
+  double (*f64_product)(const double *x, int n);
+  double (*f64_min)(const double *x, int n);
+  double (*f64_max)(const double *x, int n);
+  double (*f64_dot)(const double *x, const double *y, int n);
+} lvec_kernels;
+
+/* scalar kernels, always available and used for the vector tails */
+
+static int lvec_i64_add_scalar(int64_t *r, const int64_t *x, const int64_t *y,
+                               int n) {
+  int overflow = 0;
+  for (int i = 0; i < n; i++) {
+    uint64_t s = (uint64_t)x[i] + (uint64_t)y[i];
+    overflow |= (int)((((uint64_t)x[i] ^ s) & ((uint64_t)y[i] ^ s)) >> 63);
+    r[i] = (int64_t)s;
+  }
+  return overflow;
+}
+
+static int lvec_i64_sub_scalar(int64_t *r, const int64_t *x, const int64_t *y,
+                               int n) {
+  int overflow = 0;
+  for (int i = 0; i < n; i++) {
+    uint64_t s = (uint64_t)x[i] - (uint64_t)y[i];
+    overflow |= (int)((((uint64_t)x[i] ^ (uint64_t)y[i]) &
+                       ((uint64_t)x[i] ^ s)) >> 63);
+    r[i] = (int64_t)s;
+  }
+  return overflow;
+}
+
+static void lvec_f64_add_scalar(double *r, const double *x, const double *y,
+                                int n) {
+  for (int i = 0; i < n; i++) {
+    r[i] = x[i] + y[i];
+  }
+}
+
+static void lvec_f64_sub_scalar(double *r, const double *x, const double *y,
+                                int n) {
+  for (int i = 0; i < n; i++) {
+    r[i] = x[i] - y[i];
+  }
+}
+
+static void lvec_f64_mul_scalar(double *r, const double *x, const double *y,
+                                int n) {
+  for (int i = 0; i < n; i++) {
+    r[i] = x[i] * y[i];
+  }
+}
+
+static void lvec_f64_div_scalar(double *r, const double *x, const double *y,
+                                int n) {
+  for (int i = 0; i < n; i++) {
+    r[i] = x[i] / y[i];
+  }
+}
+
+static int lvec_i64_sum_scalar(const int64_t *x, int n, int64_t *r) {
+  int64_t s = 0;
+  int overflow = 0;
+  for (int i = 0; i < n; i++) {
+    overflow |= lvec_i64_add_scalar(&s, &s, &x[i], 1);
+  }
+  *r = s;
+  return overflow;
+}
+
+static int64_t lvec_i64_min_scalar(const int64_t *x, int n) {
+  int64_t m = x[0];
+  for (int i = 1; i < n; i++) {
+    m = x[i] < m ? x[i] : m;
+  }
+  return m;
+}
+
+static int64_t lvec_i64_max_scalar(const int64_t *x, int n) {
+  int64_t m = x[0];
+  for (int i = 1; i < n; i++) {
+    m = x[i] > m ? x[i] : m;
+  }
+  return m;
+}
+
+/* sums and dot products start from -0.0, which unlike 0.0 leaves a sum
+ * of -0.0s negative as + does */
+static double lvec_f64_sum_scalar(const double *x, int n) {
+  double s = -0.0;
+  for (int i = 0; i < n; i++) {
+    s += x[i];
+  }
+  return s;
+}
+
+static double lvec_f64_product_scalar(const double *x, int n) {
+  double p = 1;
+  for (int i = 0; i < n; i++) {
+    p *= x[i];
   }
-  if (t->children_num >= 1) {
-    int total = 1;
-    for (int i = 0; i < t->children_num; i++) {
-      total = total + number_of_nodes(t->children[i]);
+  return p;
+}
+
+/* the min or max of doubles is the first NaN if there is one, and -0.0
+ * counts as below 0.0, so the result doesn't depend on the order the
+ * elements are compared in */
+static double lvec_f64_min_scalar(const double *x, int n) {
+  double m = x[0];
+  for (int i = 0; i < n; i++) {
+    if (x[i] != x[i]) {
+      return x[i];
+    }
+    m = x[i] < m || (x[i] == m && signbit(x[i])) ? x[i] : m;
+  }
+  return m;
+}
+
+static double lvec_f64_max_scalar(const double *x, int n) {
+  double m = x[0];
+  for (int i = 0; i < n; i++) {
+    if (x[i] != x[i]) {
+      return x[i];
     }
-    return total;
+    m = x[i] > m || (x[i] == m && !signbit(x[i])) ? x[i] : m;
+  }
+  return m;
+}
+
+static double lvec_f64_dot_scalar(const double *x, const double *y, int n) {
+  double s = -0.0;
+  for (int i = 0; i < n; i++) {
+    s += x[i] * y[i];
+  }
+  return s;
+}
+
+static const lvec_kernels lvec_scalar = {
+    lvec_i64_add_scalar,     lvec_i64_sub_scalar, lvec_f64_add_scalar,
+    lvec_f64_sub_scalar,     lvec_f64_mul_scalar, lvec_f64_div_scalar,
+    lvec_i64_sum_scalar,     lvec_i64_min_scalar, lvec_i64_max_scalar,
+    lvec_f64_sum_scalar,     lvec_f64_product_scalar,
+    lvec_f64_min_scalar,     lvec_f64_max_scalar, lvec_f64_dot_scalar};
+
+#ifdef LVEC_X86
+
+/* SSE2 kernels, two lanes of 64 bits */
+
+/* an overflow happened in some lane if any sign bit is set in o */
+LVEC_SSE2 static int lvec_sse2_any_sign(__m128i o) {
+  return _mm_movemask_pd(_mm_castsi128_pd(o)) != 0;
+}
+
+LVEC_SSE2 static int lvec_i64_add_sse2(int64_t *r, const int64_t *x,
+                                       const int64_t *y, int n) {
+  __m128i o = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(y + i));
+    __m128i s = _mm_add_epi64(a, b);
+    o = _mm_or_si128(o, _mm_and_si128(_mm_xor_si128(a, s), _mm_xor_si128(b, s)));
+    _mm_storeu_si128((__m128i *)(r + i), s);
+  }
+  return lvec_sse2_any_sign(o) | lvec_i64_add_scalar(r + i, x + i, y + i, n - i);
+}
+
+LVEC_SSE2 static int lvec_i64_sub_sse2(int64_t *r, const int64_t *x,
+                                       const int64_t *y, int n) {
+  __m128i o = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(y + i));
+    __m128i s = _mm_sub_epi64(a, b);
+    o = _mm_or_si128(o, _mm_and_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, s)));
+    _mm_storeu_si128((__m128i *)(r + i), s);
+  }
+  return lvec_sse2_any_sign(o) | lvec_i64_sub_scalar(r + i, x + i, y + i, n - i);
+}
+
+#define LVEC_SSE2_F64_BINOP(name, intrinsic, op)                               \
+  LVEC_SSE2 static void name(double *r, const double *x, const double *y,      \
+                             int n) {                                          \
+    int i = 0;                                                                 \
+    for (; i + 2 <= n; i += 2) {                                               \
+      _mm_storeu_pd(r + i,                                                     \
+                    intrinsic(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));      \
+    }                                                                          \
+    for (; i < n; i++) {                                                       \
+      r[i] = x[i] op y[i];                                                     \
+    }                                                                          \
+  }
+
+LVEC_SSE2_F64_BINOP(lvec_f64_add_sse2, _mm_add_pd, +)
+LVEC_SSE2_F64_BINOP(lvec_f64_sub_sse2, _mm_sub_pd, -)
+LVEC_SSE2_F64_BINOP(lvec_f64_mul_sse2, _mm_mul_pd, *)
+LVEC_SSE2_F64_BINOP(lvec_f64_div_sse2, _mm_div_pd, /)
+
+/* lane sums overflowing doesn't mean the total does, the caller then
+ * falls back to exact arithmetic */
+LVEC_SSE2 static int lvec_i64_sum_sse2(const int64_t *x, int n, int64_t *r) {
+  __m128i s = _mm_setzero_si128();
+  __m128i o = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+    __m128i t = _mm_add_epi64(s, a);
+    o = _mm_or_si128(o, _mm_and_si128(_mm_xor_si128(s, t), _mm_xor_si128(a, t)));
+    s = t;
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, s);
+  int overflow = lvec_sse2_any_sign(o);
+  overflow |= lvec_i64_add_scalar(&lanes[0], &lanes[0], &lanes[1], 1);
+  overflow |= lvec_i64_sum_scalar(x + i, n - i, &lanes[1]);
+  overflow |= lvec_i64_add_scalar(r, &lanes[0], &lanes[1], 1);
+  return overflow;
+}
+
+#define LVEC_SSE2_F64_FOLD(name, init, intrinsic, scalar)                      \
+  LVEC_SSE2 static double name(const double *x, int n) {                       \
+    if (n < 2) {                                                               \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    __m128d acc = init;                                                        \
+    int i = 0;                                                                 \
+    for (; i + 2 <= n; i += 2) {                                               \
+      acc = intrinsic(acc, _mm_loadu_pd(x + i));                               \
+    }                                                                          \
+    double lanes[3];                                                           \
+    _mm_storeu_pd(lanes, acc);                                                 \
+    lanes[2] = i < n ? x[i] : lanes[1];                                        \
+    return scalar(lanes, 3 - (i == n));                                        \
+  }
+
+LVEC_SSE2_F64_FOLD(lvec_f64_sum_sse2, _mm_set1_pd(-0.0), _mm_add_pd,
+                   lvec_f64_sum_scalar)
+LVEC_SSE2_F64_FOLD(lvec_f64_product_sse2, _mm_set1_pd(1.0), _mm_mul_pd,
+                   lvec_f64_product_scalar)
+/* the min and max instructions give their second operand for NaNs and
+ * equal zeros. Lanes that see a NaN leave the answer to the scalar
+ * kernel, and both operand orders are merged (or for min, and for max)
+ * so -0.0 wins or loses against 0.0 as it does there */
+#define LVEC_SSE2_F64_SELECT(name, intrinsic, merge, scalar)                   \
+  LVEC_SSE2 static double name(const double *x, int n) {                       \
+    if (n < 2) {                                                               \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    __m128d acc = _mm_loadu_pd(x);                                             \
+    __m128d nan = _mm_cmpunord_pd(acc, acc);                                   \
+    int i = 2;                                                                 \
+    for (; i + 2 <= n; i += 2) {                                               \
+      __m128d v = _mm_loadu_pd(x + i);                                         \
+      nan = _mm_or_pd(nan, _mm_cmpunord_pd(v, v));                             \
+      acc = merge(intrinsic(acc, v), intrinsic(v, acc));                       \
+    }                                                                          \
+    if (_mm_movemask_pd(nan)) {                                                \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    double lanes[3];                                                           \
+    _mm_storeu_pd(lanes, acc);                                                 \
+    lanes[2] = i < n ? x[i] : lanes[1];                                        \
+    return scalar(lanes, 3 - (i == n));                                        \
+  }
+
+LVEC_SSE2_F64_SELECT(lvec_f64_min_sse2, _mm_min_pd, _mm_or_pd,
+                     lvec_f64_min_scalar)
+LVEC_SSE2_F64_SELECT(lvec_f64_max_sse2, _mm_max_pd, _mm_and_pd,
+                     lvec_f64_max_scalar)
+
+LVEC_SSE2 static double lvec_f64_dot_sse2(const double *x, const double *y,
+                                          int n) {
+  __m128d acc = _mm_set1_pd(-0.0);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + lvec_f64_dot_scalar(x + i, y + i, n - i);
+}
+
+static const lvec_kernels lvec_sse2 = {
+    lvec_i64_add_sse2,     lvec_i64_sub_sse2,     lvec_f64_add_sse2,
+    lvec_f64_sub_sse2,     lvec_f64_mul_sse2,     lvec_f64_div_sse2,
+    lvec_i64_sum_sse2,     lvec_i64_min_scalar,   lvec_i64_max_scalar,
+    lvec_f64_sum_sse2,     lvec_f64_product_sse2, lvec_f64_min_sse2,
+    lvec_f64_max_sse2,     lvec_f64_dot_sse2};
+
+/* AVX2 kernels, four lanes of 64 bits */
+
+LVEC_AVX2 static int lvec_avx2_any_sign(__m256i o) {
+  return _mm256_movemask_pd(_mm256_castsi256_pd(o)) != 0;
+}
+
+LVEC_AVX2 static int lvec_i64_add_avx2(int64_t *r, const int64_t *x,
+                                       const int64_t *y, int n) {
+  __m256i o = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(y + i));
+    __m256i s = _mm256_add_epi64(a, b);
+    o = _mm256_or_si256(
+        o, _mm256_and_si256(_mm256_xor_si256(a, s), _mm256_xor_si256(b, s)));
+    _mm256_storeu_si256((__m256i *)(r + i), s);
+  }
+  return lvec_avx2_any_sign(o) | lvec_i64_add_scalar(r + i, x + i, y + i, n - i);
+}
+
+LVEC_AVX2 static int lvec_i64_sub_avx2(int64_t *r, const int64_t *x,
+                                       const int64_t *y, int n) {
+  __m256i o = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(y + i));
+    __m256i s = _mm256_sub_epi64(a, b);
+    o = _mm256_or_si256(
+        o, _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, s)));
+    _mm256_storeu_si256((__m256i *)(r + i), s);
+  }
+  return lvec_avx2_any_sign(o) | lvec_i64_sub_scalar(r + i, x + i, y + i, n - i);
+}
+
+#define LVEC_AVX2_F64_BINOP(name, intrinsic, op)                               \
+  LVEC_AVX2 static void name(double *r, const double *x, const double *y,      \
+                             int n) {                                          \
+    int i = 0;                                                                 \
+    for (; i + 4 <= n; i += 4) {                                               \
+      _mm256_storeu_pd(                                                        \
+          r + i, intrinsic(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));   \
+    }                                                                          \
+    for (; i < n; i++) {                                                       \
+      r[i] = x[i] op y[i];                                                     \
+    }                                                                          \
+  }
+
+LVEC_AVX2_F64_BINOP(lvec_f64_add_avx2, _mm256_add_pd, +)
+LVEC_AVX2_F64_BINOP(lvec_f64_sub_avx2, _mm256_sub_pd, -)
+LVEC_AVX2_F64_BINOP(lvec_f64_mul_avx2, _mm256_mul_pd, *)
+LVEC_AVX2_F64_BINOP(lvec_f64_div_avx2, _mm256_div_pd, /)
+
+LVEC_AVX2 static int lvec_i64_sum_avx2(const int64_t *x, int n, int64_t *r) {
+  __m256i s = _mm256_setzero_si256();
+  __m256i o = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+    __m256i t = _mm256_add_epi64(s, a);
+    o = _mm256_or_si256(
+        o, _mm256_and_si256(_mm256_xor_si256(s, t), _mm256_xor_si256(a, t)));
+    s = t;
+  }
+  int64_t lanes[5];
+  _mm256_storeu_si256((__m256i *)lanes, s);
+  int overflow = lvec_avx2_any_sign(o);
+  overflow |= lvec_i64_sum_scalar(x + i, n - i, &lanes[4]);
+  overflow |= lvec_i64_sum_scalar(lanes, 5, r);
+  return overflow;
+}
+
+#define LVEC_AVX2_I64_SELECT(name, a, b, scalar)                               \
+  LVEC_AVX2 static int64_t name(const int64_t *x, int n) {                     \
+    if (n < 4) {                                                               \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    __m256i m = _mm256_loadu_si256((const __m256i *)x);                        \
+    int i = 4;                                                                 \
+    for (; i + 4 <= n; i += 4) {                                               \
+      __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));                \
+      m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(a, b));                  \
+    }                                                                          \
+    int64_t lanes[8];                                                          \
+    _mm256_storeu_si256((__m256i *)lanes, m);                                  \
+    int k = 4;                                                                 \
+    for (; i < n; i++) {                                                       \
+      lanes[k++] = x[i];                                                       \
+    }                                                                          \
+    return scalar(lanes, k);                                                   \
+  }
+
+LVEC_AVX2_I64_SELECT(lvec_i64_min_avx2, m, v, lvec_i64_min_scalar)
+LVEC_AVX2_I64_SELECT(lvec_i64_max_avx2, v, m, lvec_i64_max_scalar)
+
+#define LVEC_AVX2_F64_FOLD(name, init, intrinsic, scalar)                      \
+  LVEC_AVX2 static double name(const double *x, int n) {                       \
+    if (n < 4) {                                                               \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    __m256d acc = init;                                                        \
+    int i = 0;                                                                 \
+    for (; i + 4 <= n; i += 4) {                                               \
+      acc = intrinsic(acc, _mm256_loadu_pd(x + i));                            \
+    }                                                                          \
+    double lanes[8];                                                           \
+    _mm256_storeu_pd(lanes, acc);                                              \
+    int k = 4;                                                                 \
+    for (; i < n; i++) {                                                       \
+      lanes[k++] = x[i];                                                       \
+    }                                                                          \
+    return scalar(lanes, k);                                                   \
+  }
+
+LVEC_AVX2_F64_FOLD(lvec_f64_sum_avx2, _mm256_set1_pd(-0.0), _mm256_add_pd,
+                   lvec_f64_sum_scalar)
+LVEC_AVX2_F64_FOLD(lvec_f64_product_avx2, _mm256_set1_pd(1.0), _mm256_mul_pd,
+                   lvec_f64_product_scalar)
+#define LVEC_AVX2_F64_SELECT(name, intrinsic, merge, scalar)                   \
+  LVEC_AVX2 static double name(const double *x, int n) {                       \
+    if (n < 4) {                                                               \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    __m256d acc = _mm256_loadu_pd(x);                                          \
+    __m256d nan = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);                       \
+    int i = 4;                                                                 \
+    for (; i + 4 <= n; i += 4) {                                               \
+      __m256d v = _mm256_loadu_pd(x + i);                                      \
+      nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));              \
+      acc = merge(intrinsic(acc, v), intrinsic(v, acc));                       \
+    }                                                                          \
+    if (_mm256_movemask_pd(nan)) {                                             \
+      return scalar(x, n);                                                     \
+    }                                                                          \
+    double lanes[8];                                                           \
+    _mm256_storeu_pd(lanes, acc);                                              \
+    int k = 4;                                                                 \
+    for (; i < n; i++) {                                                       \
+      lanes[k++] = x[i];                                                       \
+    }                                                                          \
+    return scalar(lanes, k);                                                   \
+  }
+
+LVEC_AVX2_F64_SELECT(lvec_f64_min_avx2, _mm256_min_pd, _mm256_or_pd,
+                     lvec_f64_min_scalar)
+LVEC_AVX2_F64_SELECT(lvec_f64_max_avx2, _mm256_max_pd, _mm256_and_pd,
+                     lvec_f64_max_scalar)
+
+LVEC_AVX2 static double lvec_f64_dot_avx2(const double *x, const double *y,
+                                          int n) {
+  __m256d acc = _mm256_set1_pd(-0.0);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(
+        acc, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return lvec_f64_sum_scalar(lanes, 4) +
+         lvec_f64_dot_scalar(x + i, y + i, n - i);
+}
+
+static const lvec_kernels lvec_avx2 = {
+    lvec_i64_add_avx2,     lvec_i64_sub_avx2,     lvec_f64_add_avx2,
+    lvec_f64_sub_avx2,     lvec_f64_mul_avx2,     lvec_f64_div_avx2,
+    lvec_i64_sum_avx2,     lvec_i64_min_avx2,     lvec_i64_max_avx2,
+    lvec_f64_sum_avx2,     lvec_f64_product_avx2, lvec_f64_min_avx2,
+    lvec_f64_max_avx2,     lvec_f64_dot_avx2};
+
+#endif
+
+static const lvec_kernels *lvec_picked = &lvec_scalar;
+
+/* pick the widest kernels the CPU supports, once at startup so threads
+ * only ever read the choice */
+void lvec_kernels_init(void) {
+#ifdef LVEC_X86
+  int level = lsimd_level();
+  if (level == 2) {
+    lvec_picked = &lvec_avx2;
+  } else if (level == 1) {
+    lvec_picked = &lvec_sse2;
+  }
+#endif
+}
+
+static const lvec_kernels *lvec_kernels_get(void) { return lvec_picked; }
+
+/* vectors of n elements, n being at most INT_MAX as it is kept in count */
+lval *lval_i64vec(size_t n) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_I64VEC;
+  v->count = (int)n;
+  v->i64 = malloc(sizeof(int64_t) * (n ? n : 1));
+  return v;
+}
+
+lval *lval_f64vec(size_t n) {
+  lval *v = malloc(sizeof(lval));
+  v->type = LVAL_F64VEC;
+  v->count = (int)n;
+  v->f64 = malloc(sizeof(double) * (n ? n : 1));
+  return v;
+}
+
+/* an integer lval holding an element of an i64 vector, which needn't
+ * fit a long where that is 32 bits */
+static lval *lval_i64(int64_t x) {
+  if (x < LONG_MIN || x > LONG_MAX) {
+    uint32_t buf[2];
+    return lval_bignum(lbig_copy(lbig_from_long(x, buf)));
+  }
+  return lval_num((long)x);
+}
+
+/* overflow checked multiply of i64 elements, non zero on overflow */
+static int lvec_i64_mul(int64_t x, int64_t y, int64_t *r) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_mul_overflow(x, y, r);
+#else
+  if (x != 0 && y != 0 &&
+      ((x == -1 && y == INT64_MIN) || (y == -1 && x == INT64_MIN) ||
+       (x != -1 && y != -1 && (x * y) / y != x))) {
+    return 1;
   }
+  *r = x * y;
   return 0;
+#endif
+}
+
+static int lval_is_vec(lval *v) {
+  return v->type == LVAL_I64VEC || v->type == LVAL_F64VEC;
+}
+
+/* f64 copy of any vector, for mixed operations */
+static lval *lval_vec_to_f64(lval *v) {
+  lval *x = lval_f64vec(v->count);
+  if (v->type == LVAL_F64VEC) {
+    memcpy(x->f64, v->f64, sizeof(double) * v->count);
+  } else {
+    for (int i = 0; i < v->count; i++) {
+      x->f64[i] = (double)v->i64[i];
+    }
+  }
+  return x;
+}
+
+lval *builtin_i64vec(lenv *e, lval *a) {
+  LASSERT_ARG_COUNT(a, "i64vec", 1);
+  LASSERT_TYPE(a, "i64vec", 0, LVAL_QEXPR);
+
+  lval *q = a->cell[0];
+  size_t n = q->count > 0 ? (size_t)q->count : 0;
+  for (size_t i = 0; i < n; i++) {
+    LASSERT(a, q->cell[i]->type == LVAL_NUM,
+            "Function 'i64vec' passed incorrect type for element %i. "
+            "Got %s, Expected %s.",
+            (int)i, ltype_name(q->cell[i]->type), ltype_name(LVAL_NUM));
+  }
+
+  lval *v = lval_i64vec(n);
+  for (size_t i = 0; i < n; i++) {
+    v->i64[i] = q->cell[i]->num;
+  }
+  lval_del(a);
+  return v;
+}
+
+lval *builtin_f64vec(lenv *e, lval *a) {
+  LASSERT_ARG_COUNT(a, "f64vec", 1);
+
+  /* vectors convert directly */
+  if (lval_is_vec(a->cell[0])) {
+    lval *v = lval_vec_to_f64(a->cell[0]);
+    lval_del(a);
+    return v;
+  }
+
+  LASSERT_TYPE(a, "f64vec", 0, LVAL_QEXPR);
+  lval *q = a->cell[0];
+  size_t n = q->count > 0 ? (size_t)q->count : 0;
+  for (size_t i = 0; i < n; i++) {
+    LASSERT(a, lval_is_number(q->cell[i]),
+            "Function 'f64vec' passed incorrect type for element %i. "
+            "Got %s, Expected %s.",
+            (int)i, ltype_name(q->cell[i]->type), ltype_name(LVAL_NUM));
+  }
+
+  lval *v = lval_f64vec(n);
+  for (size_t i = 0; i < n; i++) {
+    v->f64[i] = lval_to_dbl(q->cell[i]);
+  }
+  lval_del(a);
+  return v;
+}
+
+lval *builtin_vec_list(lenv *e, lval *a) {
+  LASSERT_ARG_COUNT(a, "vec->list", 1);
+  LASSERT(a, lval_is_vec(a->cell[0]),
+          "Function 'vec->list' passed incorrect type for argument 0. "
+          "Got %s, Expected %s.",
+          ltype_name(a->cell[0]->type), ltype_name(LVAL_I64VEC));
+
+  lval *v = a->cell[0];
+  lval *q = lval_qexpr();
+  q->count = v->count;
+  q->cell = malloc(sizeof(lval *) * v->count);
+  for (int i = 0; i < v->count; i++) {
+    q->cell[i] = v->type == LVAL_I64VEC ? lval_i64(v->i64[i])
+                                        : lval_dbl(v->f64[i]);
+  }
+  lval_del(a);
+  return q;
+}
+
+lval *builtin_vec_len(lenv *e, lval *a) {
+  LASSERT_ARG_COUNT(a, "vec-len", 1);
+  LASSERT(a, lval_is_vec(a->cell[0]),
+          "Function 'vec-len' passed incorrect type for argument 0. "
+          "Got %s, Expected %s.",
+          ltype_name(a->cell[0]->type), ltype_name(LVAL_I64VEC));
+  int n = a->cell[0]->count;
+  lval_del(a);
+  return lval_num(n);
+}
+
+/* turn a number argument into a vector of n copies of it */
+static lval *lval_vec_fill(lval *x, int n, int f64) {
+  lval *v;
+  if (f64) {
+    v = lval_f64vec(n);
+    double d = lval_to_dbl(x);
+    for (int i = 0; i < n; i++) {
+      v->f64[i] = d;
+    }
+  } else {
+    v = lval_i64vec(n);
+    for (int i = 0; i < n; i++) {
+      v->i64[i] = x->num;
+    }
+  }
+  return v;
+}
+
+static char *lvec_op_name[] = {"vec+", "vec-", "vec*", "vec/"};
+
+/* elementwise operation on two vectors of equal length, or a vector and
+ * a number which is applied to every element */
+static lval *builtin_vec_op(lenv *e, lval *a, int op) {
+  char *name = lvec_op_name[op];
+  LASSERT_ARG_COUNT(a, name, 2);
+  for (int i = 0; i < 2; i++) {
+    LASSERT(a, lval_is_vec(a->cell[i]) || lval_is_number(a->cell[i]),
+            "Function '%s' passed incorrect type for argument %i. "
+            "Got %s, Expected %s.",
+            name, i, ltype_name(a->cell[i]->type), ltype_name(LVAL_I64VEC));
+  }
+  LASSERT(a, lval_is_vec(a->cell[0]) || lval_is_vec(a->cell[1]),
+          "Function '%s' passed no vector!", name);
+
+  /* i64 only when nothing involved is a double */
+  int f64 = 0;
+  int n = lval_is_vec(a->cell[0]) ? a->cell[0]->count : a->cell[1]->count;
+  for (int i = 0; i < 2; i++) {
+    lval *x = a->cell[i];
+    f64 |= x->type == LVAL_F64VEC || x->type == LVAL_DBL;
+    LASSERT(a, x->type != LVAL_BIGNUM,
+            "Function '%s' passed a number too large for a vector!", name);
+    LASSERT(a, !lval_is_vec(x) || x->count == n,
+            "Function '%s' passed vectors of different length. "
+            "Got %i, Expected %i.",
+            name, x->count, n);
+  }
+  for (int i = 0; i < 2; i++) {
+    lval *x = a->cell[i];
+    if (!lval_is_vec(x)) {
+      a->cell[i] = lval_vec_fill(x, n, f64);
+      lval_del(x);
+    } else if (f64 && x->type == LVAL_I64VEC) {
+      a->cell[i] = lval_vec_to_f64(x);
+      lval_del(x);
+    }
+  }
+
+  const lvec_kernels *k = lvec_kernels_get();
+  lval *x = a->cell[0];
+  lval *y = a->cell[1];
+  int overflow = 0;
+
+  if (f64) {
+    switch (op) {
+    case LOP_ADD:
+      k->f64_add(x->f64, x->f64, y->f64, n);
+      break;
+    case LOP_SUB:
+      k->f64_sub(x->f64, x->f64, y->f64, n);
+      break;
+    case LOP_MUL:
+      k->f64_mul(x->f64, x->f64, y->f64, n);
+      break;
+    case LOP_DIV:
+      k->f64_div(x->f64, x->f64, y->f64, n);
+      break;
+    }
+  } else {
+    switch (op) {
+    case LOP_ADD:
+      overflow = k->i64_add(x->i64, x->i64, y->i64, n);
+      break;
+    case LOP_SUB:
+      overflow = k->i64_sub(x->i64, x->i64, y->i64, n);
+      break;
+    case LOP_MUL:
+      for (int i = 0; i < n; i++) {
+        overflow |= lvec_i64_mul(x->i64[i], y->i64[i], &x->i64[i]);
+      }
+      break;
+    case LOP_DIV:
+      for (int i = 0; i < n; i++) {
+        if (y->i64[i] == 0) {
+          lval_del(a);
+          return lval_err("Division by zero!");
+        }
+        if (x->i64[i] == INT64_MIN && y->i64[i] == -1) {
+          overflow = 1;
+          break;
+        }
+        x->i64[i] /= y->i64[i];
+      }
+      break;
+    }
+  }
+
+  if (overflow) {
+    lval_del(a);
+    return lval_err("Integer overflow in '%s'!", name);
+  }
+  return lval_take(e, a, 0);
+}
+
+lval *builtin_vec_add(lenv *e, lval *a) { return builtin_vec_op(e, a, LOP_ADD); }
+lval *builtin_vec_sub(lenv *e, lval *a) { return builtin_vec_op(e, a, LOP_SUB); }
+lval *builtin_vec_mul(lenv *e, lval *a) { return builtin_vec_op(e, a, LOP_MUL); }
+lval *builtin_vec_div(lenv *e, lval *a) { return builtin_vec_op(e, a, LOP_DIV); }
+
+enum { LVEC_SUM, LVEC_PRODUCT, LVEC_MIN, LVEC_MAX };
+static char *lvec_fold_name[] = {"vec-sum", "vec-product", "vec-min",
+                                 "vec-max"};
+
+/* exact sum or product of an i64 vector whose fast fold overflowed */
+static lval *lvec_i64_fold_big(lval *v, int op) {
+  uint32_t buf[2];
+  lbig acc = lbig_copy(lbig_from_long(op == LVEC_SUM ? 0 : 1, buf));
+  for (int i = 0; i < v->count; i++) {
+    lbig y = lbig_from_long(v->i64[i], buf);
+    lbig r = op == LVEC_SUM ? lbig_add(acc, y) : lbig_mul(acc, y);
+    free(acc.limb);
+    acc = r;
+  }
+  return lval_bignum(acc);
+}
+
+static lval *builtin_vec_fold(lenv *e, lval *a, int op) {
+  char *name = lvec_fold_name[op];
+  LASSERT_ARG_COUNT(a, name, 1);
+  LASSERT(a, lval_is_vec(a->cell[0]),
+          "Function '%s' passed incorrect type for argument 0. "
+          "Got %s, Expected %s.",
+          name, ltype_name(a->cell[0]->type), ltype_name(LVAL_I64VEC));
+  lval *v = a->cell[0];
+  LASSERT(a, v->count > 0 || op == LVEC_SUM || op == LVEC_PRODUCT,
+          "Function '%s' passed an empty vector!", name);
+
+  const lvec_kernels *k = lvec_kernels_get();
+  lval *r = NULL;
+  int n = v->count;
+
+  if (v->type == LVAL_F64VEC) {
+    switch (op) {
+    case LVEC_SUM:
+      r = lval_dbl(n ? k->f64_sum(v->f64, n) : 0.0);
+      break;
+    case LVEC_PRODUCT:
+      r = lval_dbl(n ? k->f64_product(v->f64, n) : 1.0);
+      break;
+    case LVEC_MIN:
+      r = lval_dbl(k->f64_min(v->f64, n));
+      break;
+    case LVEC_MAX:
+      r = lval_dbl(k->f64_max(v->f64, n));
+      break;
+    }
+  } else {
+    int64_t s;
+    switch (op) {
+    case LVEC_SUM:
+      if (n == 0) {
+        r = lval_num(0);
+      } else if (k->i64_sum(v->i64, n, &s)) {
+        r = lvec_i64_fold_big(v, op);
+      } else {
+        r = lval_i64(s);
+      }
+      break;
+    case LVEC_PRODUCT: {
+      int64_t p = 1;
+      int i = 0;
+      for (; i < n && !lvec_i64_mul(p, v->i64[i], &p); i++) {
+      }
+      r = i < n ? lvec_i64_fold_big(v, op) : lval_i64(p);
+      break;
+    }
+    case LVEC_MIN:
+      r = lval_i64(k->i64_min(v->i64, n));
+      break;
+    case LVEC_MAX:
+      r = lval_i64(k->i64_max(v->i64, n));
+      break;
+    }
+  }
+
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_vec_sum(lenv *e, lval *a) { return builtin_vec_fold(e, a, LVEC_SUM); }
+lval *builtin_vec_product(lenv *e, lval *a) { return builtin_vec_fold(e, a, LVEC_PRODUCT); }
+lval *builtin_vec_min(lenv *e, lval *a) { return builtin_vec_fold(e, a, LVEC_MIN); }
+lval *builtin_vec_max(lenv *e, lval *a) { return builtin_vec_fold(e, a, LVEC_MAX); }
+
+lval *builtin_vec_dot(lenv *e, lval *a) {
+  LASSERT_ARG_COUNT(a, "vec-dot", 2);
+  for (int i = 0; i < 2; i++) {
+    LASSERT(a, lval_is_vec(a->cell[i]),
+            "Function 'vec-dot' passed incorrect type for argument %i. "
+            "Got %s, Expected %s.",
+            i, ltype_name(a->cell[i]->type), ltype_name(LVAL_I64VEC));
+  }
+  lval *x = a->cell[0];
+  lval *y = a->cell[1];
+  LASSERT(a, x->count == y->count,
+          "Function 'vec-dot' passed vectors of different length. "
+          "Got %i, Expected %i.",
+          y->count, x->count);
+
+  lval *r;
+  if (x->type == LVAL_I64VEC && y->type == LVAL_I64VEC) {
+    /* checked multiply and add, exact bignum arithmetic on overflow */
+    int64_t s = 0;
+    int i = 0;
+    for (; i < x->count; i++) {
+      int64_t p;
+      if (lvec_i64_mul(x->i64[i], y->i64[i], &p) ||
+          lvec_i64_add_scalar(&s, &s, &p, 1)) {
+        break;
+      }
+    }
+    if (i < x->count) {
+      uint32_t xbuf[2], ybuf[2];
+      lbig acc = lbig_copy(lbig_from_long(0, xbuf));
+      for (i = 0; i < x->count; i++) {
+        lbig p = lbig_mul(lbig_from_long(x->i64[i], xbuf),
+                          lbig_from_long(y->i64[i], ybuf));
+        lbig t = lbig_add(acc, p);
+        free(p.limb);
+        free(acc.limb);
+        acc = t;
+      }
+      r = lval_bignum(acc);
+    } else {
+      r = lval_i64(s);
+    }
+  } else {
+    /* anything involving an f64 vector is done in doubles */
+    int n = x->count;
+    for (int i = 0; i < 2; i++) {
+      if (a->cell[i]->type == LVAL_I64VEC) {
+        lval *t = a->cell[i];
+        a->cell[i] = lval_vec_to_f64(t);
+        lval_del(t);
+      }
+    }
+    r = lval_dbl(lvec_kernels_get()->f64_dot(a->cell[0]->f64, a->cell[1]->f64, n));
+  }
+  lval_del(a);
+  return r;
 }
@@ -1,5 +1,16 @@
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /*
 ** State Type
 */
@@ -55,12 +66,19 @@ static mpc_state_t mpc_state_new(void) {
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Where it is available files opened by mpc
+** are instead mapped into memory and scanned
+** through just like a String. Files that can't
+** be mapped, such as pipes and special files,
+** are read into a buffer up front.
+**
 */
 
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
@@ -85,6 +103,12 @@ typedef struct {
   char *buffer;
   FILE *file;
 
+  char *map;
+  size_t map_len;
+
+  struct mpc_memo_t *memo;
+  struct mpc_ast_arena_t *arena;
+
   int suppress;
   int backtrack;
   int marks_slots;
@@ -114,6 +138,10 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   strcpy(i->string, string);
   i->buffer = NULL;
   i->file = NULL;
+  i->map = NULL;
+  i->map_len = 0;
+  i->memo = NULL;
+  i->arena = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -144,6 +172,10 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string[length] = '\0';
   i->buffer = NULL;
   i->file = NULL;
+  i->map = NULL;
+  i->map_len = 0;
+  i->memo = NULL;
+  i->arena = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -173,6 +205,10 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->string = NULL;
   i->buffer = NULL;
   i->file = pipe;
+  i->map = NULL;
+  i->map_len = 0;
+  i->memo = NULL;
+  i->arena = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -201,6 +237,10 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->string = NULL;
   i->buffer = NULL;
   i->file = file;
+  i->map = NULL;
+  i->map_len = 0;
+  i->memo = NULL;
+  i->arena = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -216,12 +256,80 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   return i;
 }
 
+/*
+** Read the rest of a file as a String input. Regular
+** files are mapped when their size leaves room for
+** the zero filled end of the last page to act as
+** the terminator, everything else is read in.
+*/
+
+static mpc_input_t *mpc_input_new_contents(const char *filename, FILE *file) {
+
+  mpc_input_t *i;
+  char *string;
+  size_t len, slots, n;
+
+#ifdef MPC_USE_MMAP
+  struct stat st;
+  long offset = ftell(file);
+  long page = sysconf(_SC_PAGESIZE);
+
+  if (offset >= 0 && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)
+  &&  st.st_size > offset && page > 0 && st.st_size % page != 0) {
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+    if (map != MAP_FAILED) {
+      i = mpc_input_new_file(filename, file);
+      i->type = MPC_INPUT_MMAP;
+      i->file = NULL;
+      i->map = map;
+      i->map_len = st.st_size;
+      i->string = map + offset;
+      return i;
+    }
+  }
+#endif
+
+  slots = 4096;
+  len = 0;
+  string = malloc(slots);
+  while ((n = fread(string + len, 1, slots - len - 1, file)) > 0) {
+    len += n;
+    if (len == slots - 1) {
+      slots *= 2;
+      string = realloc(string, slots);
+    }
+  }
+  string[len] = '\0';
+
+  i = mpc_input_new_file(filename, file);
+  i->type = MPC_INPUT_STRING;
+  i->file = NULL;
+  i->string = string;
+  return i;
+}
+
+/*
+** Leave the file just after what was consumed
+** from it, as a File input would have.
+*/
+
+static void mpc_input_contents_done(mpc_input_t *i, FILE *file, long offset) {
+  if (offset >= 0) {
+    fseek(file, offset + i->state.pos, SEEK_SET);
+  }
+}
+
 static void mpc_input_delete(mpc_input_t *i) {
 
   free(i->filename);
 
   if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+#ifdef MPC_USE_MMAP
+  if (i->type == MPC_INPUT_MMAP) { munmap(i->map, i->map_len); }
+#endif
 
   free(i->marks);
   free(i->lasts);
@@ -373,7 +481,8 @@ static char mpc_input_getc(mpc_input_t *i) {
 
   switch (i->type) {
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->string[i->state.pos];
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
 
@@ -396,7 +505,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->string[i->state.pos];
     case MPC_INPUT_FILE:
 
       c = fgetc(i->file);
@@ -435,7 +545,8 @@ static int mpc_input_terminated(mpc_input_t *i) {
 static int mpc_input_failure(mpc_input_t *i, char c) {
 
   switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
 
@@ -918,7 +1029,9 @@ enum {
   MPC_TYPE_SOI        = 27,
   MPC_TYPE_EOI        = 28,
 
-  MPC_TYPE_SEPBY1     = 29
+  MPC_TYPE_SEPBY1     = 29,
+
+  MPC_TYPE_REGEX      = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -939,6 +1052,7 @@ typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdat
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_parser_t *sep; } mpc_pdata_sepby1;
+typedef struct { mpc_parser_t *x; struct mpc_rx_t *rx; int *dfa; int counted; } mpc_pdata_regex_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -959,6 +1073,7 @@ typedef union {
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
   mpc_pdata_sepby1 sepby1;
+  mpc_pdata_regex_t regex;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -968,6 +1083,43 @@ struct mpc_parser_t {
   char retained;
 };
 
+enum { MPC_TAG_BITS = 64, MPC_TAG_SLOTS = 64 };
+
+typedef struct mpc_tag_t {
+  char *name;
+  unsigned long hash;
+  int id;
+  int bit;
+  int wide;
+  unsigned long long bits;
+  const char *added;
+  int added_id;
+  struct mpc_tag_t *next;
+} mpc_tag_t;
+
+typedef struct {
+  int num;
+  int slots;
+  int bits;
+  mpc_tag_t **ids;
+  mpc_tag_t *table[MPC_TAG_SLOTS];
+} mpc_tags_t;
+
+typedef struct mpc_ast_arena_t {
+  char *block;
+  size_t used;
+  size_t size;
+  mpc_ast_t *root;
+  int mixed;
+  mpc_tags_t tags;
+} mpc_ast_arena_t;
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *m, const char *tag, const char *contents, size_t len);
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *m, size_t n);
+static void mpc_ast_delete_no_children(mpc_ast_t *a);
+static mpc_ast_arena_t *mpc_ast_arena_new(void);
+static mpc_ast_t *mpc_ast_arena_own(mpc_ast_arena_t *m, mpc_ast_t *a);
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -997,6 +1149,55 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   return a;
 }
 
+/* Like `mpcf_fold_ast` but building in the arena */
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+
+  int j, k, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  /* Children are counted first so their array is made once */
+  for (j = 0; j < n; j++) {
+    if (as[j]) { m += as[j]->children_num ? as[j]->children_num : 1; }
+  }
+
+  r = mpc_ast_arena_node(i->arena, ">", "", 0);
+  r->children = m ? mpc_ast_arena_alloc(i->arena, sizeof(mpc_ast_t*) * m) : NULL;
+
+  for (j = 0; j < n; j++) {
+
+    if (as[j] == NULL) { continue; }
+
+    if (as[j]->children_num == 0) {
+      r->children[r->children_num++] = as[j];
+    } else if (as[j]->children_num == 1) {
+      r->children[r->children_num++] = mpc_ast_add_root_tag(as[j]->children[0], as[j]->tag);
+      mpc_ast_delete_no_children(as[j]);
+    } else {
+      for (k = 0; k < as[j]->children_num; k++) {
+        r->children[r->children_num++] = as[j]->children[k];
+      }
+      mpc_ast_delete_no_children(as[j]);
+    }
+
+  }
+
+  for (k = 0; k < r->children_num; k++) {
+    if (r->children[k]->arena != i->arena) { i->arena->mixed = 1; }
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
@@ -1008,6 +1209,7 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->arena) { return mpcf_input_fold_ast(i, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -1018,14 +1220,22 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->arena
+    ? mpc_ast_arena_node(i->arena, "", c, strlen(c))
+    : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
 
+static mpc_val_t *mpcf_input_add_root(mpc_input_t *i, mpc_ast_t *a) {
+  if (a == NULL || a->children_num <= 1) { return a; }
+  return mpc_ast_add_child(mpc_ast_arena_node(i->arena, ">", "", 0), a);
+}
+
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == (mpc_apply_t)mpc_ast_add_root && i->arena) { return mpcf_input_add_root(i, x); }
   return f(mpc_export(i, x));
 }
 
@@ -1038,58 +1248,768 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Compiled Regular Expressions
+**
+** The parsers built by `mpc_re` are trees of
+** combinators which consume one character at
+** a time, marking and rewinding the input and
+** allocating a string for every character.
+**
+** Where the tree only uses characters, sets,
+** sequences, choices and repetition it is also
+** compiled into a matcher which works directly
+** on the characters of a String input. When all
+** repeated and alternative parts are single
+** characters the regex is further compiled into
+** a DFA, a table of 256 transitions per state,
+** so matching needs no backtracking at all.
+**
+** Both follow the semantics of the combinators
+** exactly: repetition is greedy and never gives
+** back, choices take the first alternative that
+** matches. Failures inside a regex still add to
+** the error report, so they are only used where
+** errors are suppressed, such as in named rules
+** and under `mpc_expect`, and only for String
+** inputs. Elsewhere the combinators run as before.
+*/
+
+enum {
+  MPC_RX_SET   = 0,
+  MPC_RX_SEQ   = 1,
+  MPC_RX_ALT   = 2,
+  MPC_RX_MAYBE = 3,
+  MPC_RX_MANY  = 4,
+  MPC_RX_MANY1 = 5,
+  MPC_RX_COUNT = 6
+};
+
+enum {
+  MPC_RX_STOP = -1,
+  MPC_RX_FAIL = -2,
+  MPC_RX_STATES_MAX = 256
+};
+
+typedef struct mpc_rx_t {
+  int type;
+  int n;
+  int count;
+  struct mpc_rx_t **xs;
+  unsigned char set[32];
+} mpc_rx_t;
+
+#define MPC_RX_IN(s, c) ((s)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+static void mpc_rx_delete(mpc_rx_t *x) {
+  int j;
+  if (x == NULL) { return; }
+  for (j = 0; j < x->n; j++) { mpc_rx_delete(x->xs[j]); }
+  free(x->xs);
+  free(x);
+}
+
+static mpc_rx_t *mpc_rx_node(int type, int n) {
+  mpc_rx_t *x = calloc(1, sizeof(mpc_rx_t));
+  x->type = type;
+  x->n = n;
+  x->xs = n > 0 ? calloc(n, sizeof(mpc_rx_t*)) : NULL;
+  return x;
+}
+
+static mpc_rx_t *mpc_rx_set(const char *s, int none) {
+  int c;
+  mpc_rx_t *x = mpc_rx_node(MPC_RX_SET, 0);
+  for (c = 1; c < 256; c++) {
+    if (s == NULL || (strchr(s, (char)c) != NULL) != none) {
+      x->set[c >> 3] |= 1 << (c & 7);
+    }
+  }
+  return x;
+}
+
+static int mpc_rx_nullable(mpc_rx_t *x) {
+  int j;
+  switch (x->type) {
+    case MPC_RX_SET: return 0;
+    case MPC_RX_SEQ:
+      for (j = 0; j < x->n; j++) { if (!mpc_rx_nullable(x->xs[j])) { return 0; } }
+      return 1;
+    case MPC_RX_ALT:
+      for (j = 0; j < x->n; j++) { if (mpc_rx_nullable(x->xs[j])) { return 1; } }
+      return 0;
+    case MPC_RX_MAYBE:
+    case MPC_RX_MANY: return 1;
+    default: return mpc_rx_nullable(x->xs[0]);
+  }
+}
+
+/*
+** Returns NULL for anything that can't be
+** matched exactly. A count which fails part
+** way leaves its input consumed, so it is only
+** accepted where a sequence rewinds it or as
+** the whole regex.
+*/
+
+static mpc_rx_t *mpc_rx_new(mpc_parser_t *p, int rewound) {
+
+  int j;
+  mpc_rx_t *x;
+
+  if (p->retained) { return NULL; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_rx_new(p->data.expect.x, rewound);
+
+    case MPC_TYPE_ANY:    return mpc_rx_set(NULL, 0);
+    case MPC_TYPE_ONEOF:  return mpc_rx_set(p->data.string.x, 0);
+    case MPC_TYPE_NONEOF: return mpc_rx_set(p->data.string.x, 1);
+    case MPC_TYPE_SINGLE:
+      x = mpc_rx_node(MPC_RX_SET, 0);
+      if (p->data.single.x) {
+        x->set[(unsigned char)p->data.single.x >> 3] |= 1 << ((unsigned char)p->data.single.x & 7);
+      }
+      return x;
+    case MPC_TYPE_RANGE:
+      x = mpc_rx_node(MPC_RX_SET, 0);
+      for (j = (unsigned char)p->data.range.x; j <= (unsigned char)p->data.range.y; j++) {
+        if (j) { x->set[j >> 3] |= 1 << (j & 7); }
+      }
+      return x;
+
+    case MPC_TYPE_LIFT:
+      return p->data.lift.lf == mpcf_ctor_str ? mpc_rx_node(MPC_RX_SEQ, 0) : NULL;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return NULL; }
+      x = mpc_rx_node(MPC_RX_SEQ, p->data.and.n);
+      for (j = 0; j < x->n; j++) {
+        x->xs[j] = mpc_rx_new(p->data.and.xs[j], 1);
+        if (x->xs[j] == NULL) { mpc_rx_delete(x); return NULL; }
+      }
+      return x;
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return NULL; }
+      x = mpc_rx_node(MPC_RX_ALT, p->data.or.n);
+      for (j = 0; j < x->n; j++) {
+        x->xs[j] = mpc_rx_new(p->data.or.xs[j], 0);
+        if (x->xs[j] == NULL) { mpc_rx_delete(x); return NULL; }
+      }
+      return x;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return NULL; }
+      x = mpc_rx_node(MPC_RX_MAYBE, 1);
+      x->xs[0] = mpc_rx_new(p->data.not.x, 0);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return NULL; }
+      if (p->type == MPC_TYPE_COUNT && (!rewound || p->data.repeat.n <= 0)) { return NULL; }
+      x = mpc_rx_node(
+        p->type == MPC_TYPE_MANY  ? MPC_RX_MANY  :
+        p->type == MPC_TYPE_MANY1 ? MPC_RX_MANY1 : MPC_RX_COUNT, 1);
+      x->count = p->data.repeat.n;
+      x->xs[0] = mpc_rx_new(p->data.repeat.x, 0);
+      if (x->xs[0] && x->type != MPC_RX_COUNT && mpc_rx_nullable(x->xs[0])) {
+        mpc_rx_delete(x);
+        return NULL;
+      }
+      break;
+
+    default: return NULL;
+  }
+
+  if (x->xs[0] == NULL) { mpc_rx_delete(x); return NULL; }
+  return x;
+}
+
+static long mpc_rx_match(const mpc_rx_t *x, const char *s) {
+
+  int j;
+  long n = 0, k;
+
+  switch (x->type) {
+
+    case MPC_RX_SET: return MPC_RX_IN(x->set, s[0]) ? 1 : -1;
+
+    case MPC_RX_SEQ:
+      for (j = 0; j < x->n; j++) {
+        if ((k = mpc_rx_match(x->xs[j], s + n)) < 0) { return -1; }
+        n += k;
+      }
+      return n;
+
+    case MPC_RX_ALT:
+      for (j = 0; j < x->n; j++) {
+        if ((k = mpc_rx_match(x->xs[j], s)) >= 0) { return k; }
+      }
+      return -1;
+
+    case MPC_RX_MAYBE:
+      k = mpc_rx_match(x->xs[0], s);
+      return k < 0 ? 0 : k;
+
+    case MPC_RX_MANY:
+    case MPC_RX_MANY1:
+      for (j = 0; (k = mpc_rx_match(x->xs[0], s + n)) >= 0; j++) { n += k; }
+      return x->type == MPC_RX_MANY1 && j == 0 ? -1 : n;
+
+    case MPC_RX_COUNT:
+      for (j = 0; j < x->count; j++) {
+        if ((k = mpc_rx_match(x->xs[0], s + n)) < 0) { return -1; }
+        n += k;
+      }
+      return n;
+
+    default: return -1;
+  }
+}
+
+/*
+** A regex compiles to a DFA when it is a sequence
+** of items, each a set of characters that must be
+** seen between `min` and `max` times. The states
+** count how often the current item has matched,
+** which only matters up to `min` when unbounded.
+*/
+
+typedef struct {
+  unsigned char *set;
+  int min, max, base;
+} mpc_rx_item_t;
+
+static int mpc_rx_single(mpc_rx_t *x, unsigned char *set) {
+  int j;
+  if (x->type == MPC_RX_SET) {
+    for (j = 0; j < 32; j++) { set[j] |= x->set[j]; }
+    return 1;
+  }
+  if (x->type == MPC_RX_ALT) {
+    for (j = 0; j < x->n; j++) {
+      if (!mpc_rx_single(x->xs[j], set)) { return 0; }
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static int mpc_rx_items(mpc_rx_t *x, mpc_rx_item_t *items, int *n) {
+
+  int j;
+  mpc_rx_t *y = x->n > 0 ? x->xs[0] : NULL;
+  mpc_rx_item_t *it;
+
+  if (x->type == MPC_RX_SEQ) {
+    for (j = 0; j < x->n; j++) {
+      if (!mpc_rx_items(x->xs[j], items, n)) { return 0; }
+    }
+    return 1;
+  }
+
+  if (*n == MPC_RX_STATES_MAX) { return 0; }
+  it = &items[(*n)++];
+
+  switch (x->type) {
+    case MPC_RX_SET:
+    case MPC_RX_ALT:   it->min = 1; it->max = 1; y = x; break;
+    case MPC_RX_MAYBE: it->min = 0; it->max = 1; break;
+    case MPC_RX_MANY:  it->min = 0; it->max = -1; break;
+    case MPC_RX_MANY1: it->min = 1; it->max = -1; break;
+    case MPC_RX_COUNT: it->min = x->count; it->max = x->count; break;
+    default: return 0;
+  }
+
+  it->set = y->set;
+  return mpc_rx_single(y, y->set);
+}
+
+static int mpc_rx_cap(mpc_rx_item_t *it) {
+  return it->max < 0 ? it->min : it->max;
+}
+
+static int mpc_rx_step(mpc_rx_item_t *items, int n, int j, int m, int c) {
+  for (; j < n; j++, m = 0) {
+    if (MPC_RX_IN(items[j].set, c) && (items[j].max < 0 || m < items[j].max)) {
+      return items[j].base + (m < mpc_rx_cap(&items[j]) ? m + 1 : m);
+    }
+    if (m < items[j].min) { return MPC_RX_FAIL; }
+  }
+  return MPC_RX_STOP;
+}
+
+static int *mpc_rx_dfa(mpc_rx_t *x) {
+
+  mpc_rx_item_t items[MPC_RX_STATES_MAX];
+  int n = 0, states = 0, j, m, c, *dfa;
+
+  if (!mpc_rx_items(x, items, &n) || n == 0) { return NULL; }
+
+  for (j = 0; j < n; j++) {
+    items[j].base = states;
+    states += mpc_rx_cap(&items[j]) + 1;
+    if (states > MPC_RX_STATES_MAX) { return NULL; }
+  }
+
+  dfa = malloc(sizeof(int) * states * 256);
+  for (j = 0; j < n; j++) {
+    for (m = 0; m <= mpc_rx_cap(&items[j]); m++) {
+      for (c = 0; c < 256; c++) {
+        dfa[(items[j].base + m) * 256 + c] = mpc_rx_step(items, n, j, m, c);
+      }
+    }
+  }
+
+  return dfa;
+}
+
+static long mpc_rx_run(const int *dfa, const char *s) {
+  int q = 0, t;
+  long n = 0;
+  while ((t = dfa[q * 256 + (unsigned char)s[n]]) >= 0) { q = t; n++; }
+  return t == MPC_RX_STOP ? n : -1;
+}
+
+static void mpc_regex_build(mpc_pdata_regex_t *d, mpc_parser_t *x) {
+  d->x = x;
+  d->rx = mpc_rx_new(x, 1);
+  d->dfa = d->rx ? mpc_rx_dfa(d->rx) : NULL;
+  d->counted = x->type == MPC_TYPE_COUNT;
+  if (d->dfa) {
+    mpc_rx_delete(d->rx);
+    d->rx = NULL;
+  }
+}
+
+/*
+** Consume `n` characters of a String input at
+** once, as that many successes would have.
+*/
+
+static char *mpc_input_span(mpc_input_t *i, long n) {
+  long j;
+  const char *s = i->string + i->state.pos;
+  char *o = mpc_malloc(i, n + 1);
+  memcpy(o, s, n);
+  o[n] = '\0';
+  for (j = 0; j < n; j++) {
+    i->state.col++;
+    if (s[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  if (n > 0) { i->last = s[n-1]; }
+  i->state.pos += n;
+  return o;
+}
+
+static long mpc_regex_match(mpc_input_t *i, mpc_pdata_regex_t *d) {
+  if (!i->suppress || i->backtrack < 1
+  || (i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP)) { return -2; }
+  return d->dfa
+    ? mpc_rx_run(d->dfa, i->string + i->state.pos)
+    : mpc_rx_match(d->rx, i->string + i->state.pos);
+}
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+/*
+** Packrat Memoization
+**
+** With `MPC_PARSE_PACKRAT` the result of every
+** named parser (those made with `mpc_new`) is
+** remembered for the position and input state
+** where it ran, so when alternatives backtrack
+** over the same input it isn't parsed again.
+**
+** Outputs and errors are owned by whoever
+** receives them, so remembered results are
+** handed out as copies. As most results are
+** never asked for again, the first time only
+** records that the parser was seen, and the
+** copy is kept once it has been run a second
+** time, so no parser runs more than twice at
+** one position. Only `mpc_ast_t` outputs can
+** be copied, which covers grammars built with
+** `mpca_lang` and `mpca_grammar`. For other
+** parsers only failures are kept.
+**
+** The table grows up to `MPC_MEMO_MAX` entries,
+** after which it is emptied and starts again.
+** This is only available for inputs held in
+** memory, so pipes and plain files ignore it.
+*/
 
-static mpc_result_t *mpc_grow_results(mpc_input_t *i, int j, mpc_result_t *results_stk, mpc_result_t *results){
-  mpc_result_t *tmp_results = results;
+enum {
+  MPC_MEMO_MIN = 1024,
+  MPC_MEMO_MAX = 1 << 18
+};
+
+enum {
+  MPC_MEMO_FAILED = 0,
+  MPC_MEMO_SEEN   = 1,
+  MPC_MEMO_KEPT   = 2
+};
 
-  if (j == MPC_PARSE_STACK_MIN) {
-    int results_slots = j + j / 2;
-    tmp_results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-    memcpy(tmp_results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-  } else if (j >= MPC_PARSE_STACK_MIN) {
-    int results_slots = j + j / 2;
-    tmp_results = mpc_realloc(i, tmp_results, sizeof(mpc_result_t) * results_slots);
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int ctx;
+  int result;
+  char last;
+  mpc_state_t state;
+  mpc_ast_t *output;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+} mpc_memo_entry_t;
+
+typedef struct mpc_memo_t {
+  int slots;
+  int used;
+  mpc_memo_entry_t *entries;
+} mpc_memo_t;
+
+static mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  int j;
+  mpc_ast_t *c;
+  if (a == NULL) { return NULL; }
+  c = mpc_ast_new(a->tag, a->contents);
+  c->state = a->state;
+  c->children_num = a->children_num;
+  c->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+  for (j = 0; j < a->children_num; j++) {
+    c->children[j] = mpc_ast_copy(a->children[j]);
   }
+  return c;
+}
 
-  return tmp_results;
+/* Copies are made outside of the input's pool, which they would fill */
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+  int j;
+  mpc_err_t *c;
+  if (x == NULL) { return NULL; }
+  c = malloc(sizeof(mpc_err_t));
+  *c = *x;
+  c->filename = malloc(strlen(x->filename) + 1);
+  strcpy(c->filename, x->filename);
+  c->failure = NULL;
+  if (x->failure) {
+    c->failure = malloc(strlen(x->failure) + 1);
+    strcpy(c->failure, x->failure);
+  }
+  c->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    c->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(c->expected[j], x->expected[j]);
+  }
+  return c;
 }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+/* Whether a parser's output is always an `mpc_ast_t` or `NULL` */
+static int mpc_memo_ast(mpc_parser_t *p) {
+  int j;
+  switch (p->type) {
+    case MPC_TYPE_PASS:       return 1;
+    case MPC_TYPE_LIFT:       return p->data.lift.lf == mpcf_ctor_null;
+    case MPC_TYPE_EXPECT:     return mpc_memo_ast(p->data.expect.x);
+    case MPC_TYPE_PREDICT:    return mpc_memo_ast(p->data.predict.x);
+    case MPC_TYPE_CHECK:      return mpc_memo_ast(p->data.check.x);
+    case MPC_TYPE_CHECK_WITH: return mpc_memo_ast(p->data.check_with.x);
+    case MPC_TYPE_NOT:        return p->data.not.lf == mpcf_ctor_null;
+    case MPC_TYPE_MAYBE:      return p->data.not.lf == mpcf_ctor_null && mpc_memo_ast(p->data.not.x);
+    case MPC_TYPE_APPLY:
+      return p->data.apply.f == mpcf_str_ast
+          || p->data.apply.f == (mpc_apply_t)mpc_ast_add_root;
+    case MPC_TYPE_APPLY_TO:
+      return p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_tag
+          || p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_tag;
+    case MPC_TYPE_AND:
+      return p->data.and.f == mpcf_fold_ast || p->data.and.f == mpcf_state_ast;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.f == mpcf_fold_ast;
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_memo_ast(p->data.or.xs[j])) { return 0; }
+      }
+      return 1;
+    default: return 0;
+  }
+}
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
+static size_t mpc_memo_hash(mpc_parser_t *p, long pos, int ctx, int slots) {
+  unsigned long h = (unsigned long)(size_t)p ^ ((unsigned long)pos << 3) ^ (unsigned long)ctx;
+  h ^= h >> 16; h *= 0x45d9f3bUL;
+  h ^= h >> 16; h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  return (size_t)h & (size_t)(slots - 1);
+}
+
+static void mpc_memo_clear(mpc_input_t *i, mpc_memo_entry_t *x) {
+  if (x->output) { mpc_ast_delete(x->output); }
+  mpc_err_delete_internal(i, x->error);
+  mpc_err_delete_internal(i, x->merged);
+}
+
+static void mpc_memo_empty(mpc_input_t *i) {
+  int j;
+  for (j = 0; j < i->memo->slots; j++) {
+    if (i->memo->entries[j].p) { mpc_memo_clear(i, &i->memo->entries[j]); }
+  }
+  memset(i->memo->entries, 0, sizeof(mpc_memo_entry_t) * i->memo->slots);
+  i->memo->used = 0;
+}
+
+static void mpc_memo_delete(mpc_input_t *i) {
+  if (i->memo == NULL) { return; }
+  mpc_memo_empty(i);
+  free(i->memo->entries);
+  free(i->memo);
+  i->memo = NULL;
+}
+
+static mpc_memo_entry_t *mpc_memo_find(mpc_memo_t *m, mpc_parser_t *p, long pos, int ctx) {
+  size_t h = mpc_memo_hash(p, pos, ctx, m->slots);
+  while (m->entries[h].p) {
+    if (m->entries[h].p == p && m->entries[h].pos == pos && m->entries[h].ctx == ctx) {
+      return &m->entries[h];
+    }
+    h = (h + 1) & (size_t)(m->slots - 1);
+  }
+  return NULL;
+}
+
+static mpc_memo_entry_t *mpc_memo_slot(mpc_input_t *i, mpc_parser_t *p, long pos, int ctx) {
+
+  int j;
+  size_t h;
+  mpc_memo_t *m = i->memo;
+  mpc_memo_entry_t *old;
+
+  if (m->used >= m->slots / 2 && m->slots < MPC_MEMO_MAX) {
+    old = m->entries;
+    m->slots *= 2;
+    m->entries = calloc(m->slots, sizeof(mpc_memo_entry_t));
+    for (j = 0; j < m->slots / 2; j++) {
+      if (old[j].p == NULL) { continue; }
+      h = mpc_memo_hash(old[j].p, old[j].pos, old[j].ctx, m->slots);
+      while (m->entries[h].p) { h = (h + 1) & (size_t)(m->slots - 1); }
+      m->entries[h] = old[j];
+    }
+    free(old);
+  }
+
+  if (m->used >= m->slots / 2) { mpc_memo_empty(i); }
+
+  h = mpc_memo_hash(p, pos, ctx, m->slots);
+  while (m->entries[h].p) { h = (h + 1) & (size_t)(m->slots - 1); }
+  m->used++;
+  return &m->entries[h];
+}
+
+/* Replays a remembered result, or returns -1 when there is none */
+static int mpc_memo_replay(mpc_input_t *i, mpc_memo_entry_t *x, mpc_result_t *r, mpc_err_t **e) {
+
+  if (x == NULL || x->result == MPC_MEMO_SEEN) { return -1; }
+
+  i->state = x->state;
+  i->last = x->last;
+  if (x->merged) { *e = mpc_err_merge(i, *e, mpc_err_copy(x->merged)); }
+  if (x->result == MPC_MEMO_KEPT) {
+    r->output = mpc_ast_copy(x->output);
+    return 1;
+  }
+  r->error = mpc_err_copy(x->error);
+  return 0;
+}
+
+static void mpc_memo_store(mpc_input_t *i, mpc_parser_t *p, long pos, int ctx, int seen, int ok, mpc_result_t *r, mpc_err_t *merged) {
+
+  mpc_memo_entry_t *x;
+
+  if (!seen) {
+    x = mpc_memo_slot(i, p, pos, ctx);
+    x->p = p;
+    x->pos = pos;
+    x->ctx = ctx;
+    x->result = MPC_MEMO_SEEN;
+    return;
+  }
+
+  if (ok && !mpc_memo_ast(p)) { return; }
+
+  /* The table may have been changed by the parsers just run */
+  x = mpc_memo_find(i->memo, p, pos, ctx);
+  if (x == NULL) {
+    x = mpc_memo_slot(i, p, pos, ctx);
+    x->p = p;
+    x->pos = pos;
+    x->ctx = ctx;
+  }
+  x->result = ok ? MPC_MEMO_KEPT : MPC_MEMO_FAILED;
+  x->last = i->last;
+  x->state = i->state;
+  x->output = ok ? mpc_ast_copy(r->output) : NULL;
+  x->error = ok ? NULL : mpc_err_copy(r->error);
+  x->merged = mpc_err_copy(merged);
+}
+
+static int mpc_memo_ctx(mpc_input_t *i) {
+  return (i->suppress > 0) | (i->backtrack > 0) << 1 | (i->state.term != 0) << 2;
+}
+
+/*
+** Parse Engine
+**
+** Rather than recursing in C, parsers are run on
+** a stack of frames kept on the heap, so input
+** can be nested as deeply as memory allows, up
+** to the limit set with `mpc_max_depth`.
+**
+** Each frame holds a parser, how far it has
+** got, and the results it has collected. To run
+** a sub-parser a frame says where to resume and
+** pushes it, and once that is done it is popped
+** and its result handed back in `ok` and `ret`.
+**
+** Errors merged along the way go to the frame
+** given by `err`, which is the nearest one being
+** memoized, or to `e` when there is none.
+*/
+
+#ifndef MPC_MAX_DEPTH
+#define MPC_MAX_DEPTH (1 << 18)
+#endif
+
+static int mpc_max_depth_num = MPC_MAX_DEPTH;
+
+void mpc_max_depth(int depth) {
+  mpc_max_depth_num = depth > 0 ? depth : MPC_MAX_DEPTH;
+}
+
+typedef struct {
+  mpc_parser_t *p;
+  int state;
+  int j;
+  int slots;
+  int err;
   mpc_result_t *results;
+  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
+  int memo;
+  int seen;
+  int ctx;
+  long pos;
+  mpc_err_t *merged;
+} mpc_frame_t;
+
+/* Makes room for result `j` of a repeat */
+static void mpc_frame_grow(mpc_input_t *i, mpc_frame_t *f) {
+  if (f->j < MPC_PARSE_STACK_MIN) { return; }
+  if (f->results == NULL) {
+    f->slots = f->j + f->j / 2;
+    f->results = mpc_malloc(i, sizeof(mpc_result_t) * f->slots);
+    memcpy(f->results, f->results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+  } else if (f->j >= f->slots) {
+    f->slots = f->j + f->j / 2;
+    f->results = mpc_realloc(i, f->results, sizeof(mpc_result_t) * f->slots);
+  }
+}
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+/* Makes room for the results of `n` parsers */
+static void mpc_frame_fixed(mpc_input_t *i, mpc_frame_t *f, int n) {
+  f->results = n > MPC_PARSE_STACK_MIN ? mpc_malloc(i, sizeof(mpc_result_t) * n) : NULL;
+}
+
+static void mpc_frame_free(mpc_input_t *i, mpc_frame_t *f) {
+  if (f->results) { mpc_free(i, f->results); }
+}
+
+#define MPC_CALL(x, s) f->state = s; c = x; goto call
+#define MPC_RETURN(o, x) ok = o; ret.output = x; goto finish
+#define MPC_SUCCESS(x) MPC_RETURN(1, x)
+#define MPC_FAILURE(x) MPC_RETURN(0, x)
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(ret.output); } \
+  else { MPC_FAILURE(NULL); }
+#define MPC_MERGE(x) \
+  t = f->err < 0 ? e : &stk[f->err].merged; \
+  *t = mpc_err_merge(i, *t, x)
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+
+  int ok = 0, num = 0, slots = 0, k;
+  int memo = i->memo != NULL;
+  long n;
+  mpc_frame_t *stk = NULL, *f = NULL;
+  mpc_result_t ret, *results;
+  mpc_parser_t *c = p;
+  mpc_err_t **t;
+
+call:
+
+  /* Remembered results are handed straight back */
+  if (memo && c->retained) {
+    t = f == NULL || f->err < 0 ? e : &stk[f->err].merged;
+    ok = mpc_memo_replay(i, mpc_memo_find(i->memo, c, i->state.pos, mpc_memo_ctx(i)), &ret, t);
+    if (ok >= 0) { goto resume; }
+  }
+
+  if (num == mpc_max_depth_num) {
+    ok = 0;
+    ret.error = mpc_err_fail(i, "Maximum recursion depth exceeded!");
+    goto resume;
+  }
+
+  if (num == slots) {
+    slots = slots ? slots * 2 : 64;
+    stk = realloc(stk, sizeof(mpc_frame_t) * slots);
+  }
+
+  f = &stk[num++];
+  f->p = c;
+  f->state = 0;
+  f->j = 0;
+  f->results = NULL;
+  f->err = num > 1 ? stk[num-2].err : -1;
+  f->memo = memo && c->retained;
+
+  if (f->memo) {
+    f->err = num - 1;
+    f->merged = NULL;
+    f->pos = i->state.pos;
+    f->ctx = mpc_memo_ctx(i);
+    f->seen = mpc_memo_find(i->memo, c, f->pos, f->ctx) != NULL;
   }
 
+run:
+
+  p = f->p;
+  results = f->results ? f->results : f->results_stk;
+
   switch (p->type) {
 
     /* Basic Parsers */
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&ret.output));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&ret.output));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&ret.output));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&ret.output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&ret.output));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&ret.output));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&ret.output));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&ret.output));
+    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&ret.output));
+    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&ret.output));
 
     /* Other parsers */
 
@@ -1103,74 +2023,93 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     /* Application Parsers */
 
     case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
+      if (f->state == 0) { MPC_CALL(p->data.apply.x, 1); }
+      if (ok) {
+        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, ret.output));
       } else {
-        MPC_FAILURE(r->output);
+        MPC_FAILURE(ret.output);
       }
 
     case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
+      if (f->state == 0) { MPC_CALL(p->data.apply_to.x, 1); }
+      if (ok) {
+        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, ret.output, p->data.apply_to.d));
       } else {
-        MPC_FAILURE(r->error);
+        MPC_FAILURE(ret.error);
       }
 
     case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
+      if (f->state == 0) { MPC_CALL(p->data.check.x, 1); }
+      if (ok) {
+        if (p->data.check.f(&ret.output)) {
+          MPC_SUCCESS(ret.output);
         } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
+          mpc_parse_dtor(i, p->data.check.dx, ret.output);
           MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
         }
       } else {
-        MPC_FAILURE(r->error);
+        MPC_FAILURE(ret.error);
       }
 
     case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
+      if (f->state == 0) { MPC_CALL(p->data.check_with.x, 1); }
+      if (ok) {
+        if (p->data.check_with.f(&ret.output, p->data.check_with.d)) {
+          MPC_SUCCESS(ret.output);
         } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
+          mpc_parse_dtor(i, p->data.check.dx, ret.output);
           MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
         }
       } else {
-        MPC_FAILURE(r->error);
+        MPC_FAILURE(ret.error);
       }
 
     case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
+      if (f->state == 0) {
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.expect.x, 1);
+      }
+      mpc_input_suppress_disable(i);
+      if (ok) {
+        MPC_SUCCESS(ret.output);
       } else {
-        mpc_input_suppress_disable(i);
         MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
       }
 
+    case MPC_TYPE_REGEX:
+      if (f->state == 0) {
+        if ((n = mpc_regex_match(i, &p->data.regex)) >= 0) {
+          MPC_SUCCESS(mpc_input_span(i, n));
+        }
+        if (n == -1 && !p->data.regex.counted) {
+          MPC_FAILURE(NULL);
+        }
+        MPC_CALL(p->data.regex.x, 1);
+      }
+      MPC_RETURN(ok, ret.output);
+
     case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
+      if (f->state == 0) {
+        mpc_input_backtrack_disable(i);
+        MPC_CALL(p->data.predict.x, 1);
       }
+      mpc_input_backtrack_enable(i);
+      MPC_RETURN(ok, ret.output);
 
     /* Optional Parsers */
 
     /* TODO: Update Not Error Message */
 
     case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
+      if (f->state == 0) {
+        mpc_input_mark(i);
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.not.x, 1);
+      }
+      if (ok) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        mpc_parse_dtor(i, p->data.not.dx, ret.output);
         MPC_FAILURE(mpc_err_new(i, "opposite"));
       } else {
         mpc_input_unmark(i);
@@ -1179,149 +2118,124 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       }
 
     case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        MPC_SUCCESS(r->output);
+      if (f->state == 0) { MPC_CALL(p->data.not.x, 1); }
+      if (ok) {
+        MPC_SUCCESS(ret.output);
       } else {
-        *e = mpc_err_merge(i, *e, r->error);
+        MPC_MERGE(ret.error);
         MPC_SUCCESS(p->data.not.lf());
       }
 
     /* Repeat Parsers */
 
     case MPC_TYPE_MANY:
-
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
-      }
-
-      *e = mpc_err_merge(i, *e, results[j].error);
-
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-
     case MPC_TYPE_MANY1:
 
-      results = results_stk;
+      if (f->state == 0) { MPC_CALL(p->data.repeat.x, 1); }
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
+      results[f->j] = ret;
+      if (ok) {
+        f->j++;
+        mpc_frame_grow(i, f);
+        MPC_CALL(p->data.repeat.x, 1);
       }
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-
-        *e = mpc_err_merge(i, *e, results[j].error);
-
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+        ret.error = mpc_err_many1(i, results[0].error);
+        mpc_frame_free(i, f);
+        MPC_FAILURE(ret.error);
       }
 
-   case MPC_TYPE_SEPBY1:
+      MPC_MERGE(results[f->j].error);
+      ret.output = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)results);
+      mpc_frame_free(i, f);
+      MPC_SUCCESS(ret.output);
 
-      results = results_stk;
+    case MPC_TYPE_SEPBY1:
 
-      if(mpc_parse_run(i, p->data.sepby1.x, &results[j], e, depth+1)){
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
+      if (f->state == 0) { MPC_CALL(p->data.sepby1.x, 1); }
 
-        while (
-          mpc_parse_run(i, p->data.sepby1.sep, &results[j], e, depth+1) &&
-          mpc_parse_run(i, p->data.sepby1.x, &results[j], e, depth+1)
-        ) {
-          j++;
-          results = mpc_grow_results(i, j, results_stk, results);
-        }
+      results[f->j] = ret;
+      if (ok && f->state == 1) {
+        f->j++;
+        mpc_frame_grow(i, f);
+        MPC_CALL(p->data.sepby1.sep, 2);
       }
+      if (ok) { MPC_CALL(p->data.sepby1.x, 1); }
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (f->j == 0) {
+        ret.error = mpc_err_many1(i, results[0].error);
+        mpc_frame_free(i, f);
+        MPC_FAILURE(ret.error);
       }
 
+      MPC_MERGE(results[f->j].error);
+      ret.output = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)results);
+      mpc_frame_free(i, f);
+      MPC_SUCCESS(ret.output);
+
     case MPC_TYPE_COUNT:
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+      if (f->state == 0) {
+        mpc_frame_fixed(i, f, p->data.repeat.n);
+        MPC_CALL(p->data.repeat.x, 1);
+      }
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+      results[f->j] = ret;
+      if (ok) {
+        f->j++;
+        if (f->j != p->data.repeat.n) { MPC_CALL(p->data.repeat.x, 1); }
+        ret.output = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)results);
+        mpc_frame_free(i, f);
+        MPC_SUCCESS(ret.output);
       }
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      for (k = 0; k < f->j; k++) {
+        mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
       }
+      ret.error = mpc_err_count(i, results[f->j].error, p->data.repeat.n);
+      mpc_frame_free(i, f);
+      MPC_FAILURE(ret.error);
 
     /* Combinatory Parsers */
 
     case MPC_TYPE_OR:
 
       if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      if (f->state == 0) { MPC_CALL(p->data.or.xs[0], 1); }
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        }
-      }
+      if (ok) { MPC_SUCCESS(ret.output); }
 
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      MPC_MERGE(ret.error);
+      if (++f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j], 1); }
+      MPC_FAILURE(NULL);
 
     case MPC_TYPE_AND:
+
       if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (f->state == 0) {
+        mpc_frame_fixed(i, f, p->data.and.n);
+        mpc_input_mark(i);
+        MPC_CALL(p->data.and.xs[0], 1);
+      }
+
+      results[f->j] = ret;
+      if (!ok) {
+        mpc_input_rewind(i);
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
         }
+        mpc_frame_free(i, f);
+        MPC_FAILURE(ret.error);
       }
+
+      if (++f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j], 1); }
+
       mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      ret.output = mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)results);
+      mpc_frame_free(i, f);
+      MPC_SUCCESS(ret.output);
 
     /* End */
 
@@ -1330,32 +2244,116 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
   }
 
-  return 0;
+finish:
 
+  if (f->memo) {
+    mpc_memo_store(i, f->p, f->pos, f->ctx, f->seen, ok, &ret, f->merged);
+    t = num < 2 || stk[num-2].err < 0 ? e : &stk[stk[num-2].err].merged;
+    if (f->merged) { *t = mpc_err_merge(i, *t, f->merged); }
+  }
+  num--;
+
+resume:
+
+  if (num == 0) {
+    free(stk);
+    *r = ret;
+    return ok;
+  }
+
+  f = &stk[num-1];
+  goto run;
 }
 
+#undef MPC_CALL
+#undef MPC_RETURN
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_MERGE
+
+/*
+** With `MPC_PARSE_FAST` the input is first parsed
+** with errors suppressed, so no `mpc_err_t` is
+** built for alternatives that fail along the way.
+** Only if that fails is the input parsed again
+** from the start to collect the full error. Any
+** functions in the grammar then run twice over
+** the input, so this is only available for inputs
+** held in memory, which can be parsed again.
+*/
+
+static int mpc_parse_fast(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
-  if (x) {
-    mpc_err_delete_internal(i, e);
-    r->output = mpc_export(i, r->output);
+  mpc_err_t *e = NULL;
+  mpc_state_t state = i->state;
+  char last = i->last;
+
+  mpc_input_suppress_enable(i);
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_input_suppress_disable(i);
+  mpc_err_delete_internal(i, e);
+
+  if (x) { return 1; }
+
+  mpc_err_delete_internal(i, r->error);
+  i->state = state;
+  i->last = last;
+  if (i->memo) { mpc_memo_empty(i); }
+  return 0;
+}
+
+static int mpc_parse_input_mode(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, int mode) {
+  int x;
+  mpc_err_t *e;
+  int memory = i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP;
+
+  if ((mode & MPC_PARSE_PACKRAT) && memory) {
+    i->memo = calloc(1, sizeof(mpc_memo_t));
+    i->memo->slots = MPC_MEMO_MIN;
+    i->memo->entries = calloc(MPC_MEMO_MIN, sizeof(mpc_memo_entry_t));
+  }
+
+  if ((mode & MPC_PARSE_ARENA) && mpc_memo_ast(p)) {
+    i->arena = mpc_ast_arena_new();
+  }
+
+  if ((mode & MPC_PARSE_FAST) && memory && mpc_parse_fast(i, p, r)) {
+    x = 1;
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    e = mpc_err_fail(i, "Unknown Error");
+    e->state = mpc_state_invalid();
+    x = mpc_parse_run(i, p, r, &e);
+    if (x) {
+      mpc_err_delete_internal(i, e);
+    } else {
+      r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    }
+  }
+
+  if (x) { r->output = mpc_export(i, r->output); }
+  if (i->arena) {
+    if (x) { r->output = mpc_ast_arena_own(i->arena, r->output); }
+    else { mpc_ast_arena_own(i->arena, NULL); }
+    i->arena = NULL;
   }
+  mpc_memo_delete(i);
   return x;
 }
 
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_input_mode(i, p, r, MPC_PARSE_DEFAULT);
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_mode(filename, string, p, r, MPC_PARSE_DEFAULT);
+}
+
+int mpc_parse_mode(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, int mode) {
   int x;
   mpc_input_t *i = mpc_input_new_string(filename, string);
-  x = mpc_parse_input(i, p, r);
+  x = mpc_parse_input_mode(i, p, r, mode);
   mpc_input_delete(i);
   return x;
 }
@@ -1369,9 +2367,15 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
 }
 
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_file_mode(filename, file, p, r, MPC_PARSE_DEFAULT);
+}
+
+int mpc_parse_file_mode(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r, int mode) {
   int x;
-  mpc_input_t *i = mpc_input_new_file(filename, file);
-  x = mpc_parse_input(i, p, r);
+  long offset = ftell(file);
+  mpc_input_t *i = mpc_input_new_contents(filename, file);
+  x = mpc_parse_input_mode(i, p, r, mode);
+  mpc_input_contents_done(i, file, offset);
   mpc_input_delete(i);
   return x;
 }
@@ -1385,6 +2389,10 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 }
 
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_contents_mode(filename, p, r, MPC_PARSE_DEFAULT);
+}
+
+int mpc_parse_contents_mode(const char *filename, mpc_parser_t *p, mpc_result_t *r, int mode) {
 
   FILE *f = fopen(filename, "rb");
   int res;
@@ -1395,7 +2403,7 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
 
-  res = mpc_parse_file(filename, f, p, r);
+  res = mpc_parse_file_mode(filename, f, p, r, mode);
   fclose(f);
   return res;
 }
@@ -1445,6 +2453,12 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
 
+    case MPC_TYPE_REGEX:
+      mpc_undefine_unretained(p->data.regex.x, 0);
+      mpc_rx_delete(p->data.regex.rx);
+      free(p->data.regex.dfa);
+      break;
+
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
       mpc_undefine_unretained(p->data.not.x, 0);
@@ -1557,6 +2571,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_REGEX:    mpc_regex_build(&p->data.regex, mpc_copy(a->data.regex.x)); break;
 
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -2409,6 +3424,17 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+static mpc_parser_t *mpc_regex_compile(mpc_parser_t *x) {
+  mpc_parser_t *p;
+  mpc_pdata_regex_t d;
+  mpc_regex_build(&d, x);
+  if (!d.rx && !d.dfa) { return x; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_REGEX;
+  p->data.regex = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   return mpc_re_mode(re, MPC_RE_DEFAULT);
 }
@@ -2476,7 +3502,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return mpc_regex_compile(r.output);
 
 }
 
@@ -2809,6 +3835,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)    { mpc_print_unretained(p->data.regex.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2932,16 +3959,242 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+/*
+** Nodes built in an arena have their tags
+** interned in a table owned by that arena, so
+** the nodes of one parse share one copy of each
+** tag and can be compared by `tag_id`. Each name
+** between the `|` of a tag is also given a bit,
+** which lets `mpc_ast_has_tag` test for a name
+** in constant time. The table goes with the
+** arena. Other nodes own their tag string and
+** have a `tag_id` of -1.
+*/
+
+static unsigned long mpc_tag_hash(unsigned long h, const char *s, size_t n) {
+  size_t j;
+  for (j = 0; j < n; j++) { h = (h ^ (unsigned char)s[j]) * 16777619UL; }
+  return h;
+}
+
+static int mpc_tag_bit(mpc_tags_t *g, mpc_tag_t *t) {
+  if (t->bit < 0 && g->bits < MPC_TAG_BITS) { t->bit = g->bits++; }
+  return t->bit;
+}
+
+static mpc_tag_t *mpc_tag_find(mpc_ast_arena_t *m, const char *a, size_t an, const char *b, size_t bn, int insert);
+
+static void mpc_tag_names(mpc_ast_arena_t *m, mpc_tag_t *t) {
+
+  const char *s = t->name, *e;
+  mpc_tag_t *n;
+  int bit;
+
+  if (*s == '\0') { return; }
+
+  if (strchr(s, '|') == NULL) {
+    bit = mpc_tag_bit(&m->tags, t);
+    if (bit < 0) { t->wide = 1; } else { t->bits = 1ULL << bit; }
+    return;
+  }
+
+  while (*s) {
+    e = strchr(s, '|');
+    if (e == NULL) { e = s + strlen(s); }
+    if (e == s) { s = *e ? e + 1 : e; continue; }
+    n = mpc_tag_find(m, s, e - s, "", 0, 1);
+    bit = mpc_tag_bit(&m->tags, n);
+    if (bit < 0) { t->wide = 1; } else { t->bits |= 1ULL << bit; }
+    s = *e ? e + 1 : e;
+  }
+}
+
+/* Finds the tag made of `a` followed by `b` */
+static mpc_tag_t *mpc_tag_find(mpc_ast_arena_t *m, const char *a, size_t an, const char *b, size_t bn, int insert) {
+
+  mpc_tags_t *g = &m->tags;
+  unsigned long h = mpc_tag_hash(mpc_tag_hash(2166136261UL, a, an), b, bn);
+  mpc_tag_t *t = g->table[h % MPC_TAG_SLOTS];
+
+  while (t) {
+    if (t->hash == h && strlen(t->name) == an + bn
+    &&  memcmp(t->name, a, an) == 0 && memcmp(t->name + an, b, bn) == 0) {
+      return t;
+    }
+    t = t->next;
+  }
+
+  if (!insert) { return NULL; }
+
+  if (g->num == g->slots) {
+    g->slots = g->slots ? g->slots * 2 : 16;
+    g->ids = realloc(g->ids, sizeof(mpc_tag_t*) * g->slots);
+  }
+
+  t = mpc_ast_arena_alloc(m, sizeof(mpc_tag_t));
+  t->name = mpc_ast_arena_alloc(m, an + bn + 1);
+  memcpy(t->name, a, an);
+  memcpy(t->name + an, b, bn);
+  t->name[an + bn] = '\0';
+  t->hash = h;
+  t->id = g->num;
+  t->bit = -1;
+  t->wide = 0;
+  t->bits = 0;
+  t->added = NULL;
+  t->added_id = -1;
+  t->next = g->table[h % MPC_TAG_SLOTS];
+  g->table[h % MPC_TAG_SLOTS] = t;
+  g->ids[g->num++] = t;
+
+  mpc_tag_names(m, t);
+  return t;
+}
+
+static mpc_ast_t *mpc_ast_retag(mpc_ast_t *a, int id) {
+  a->tag_id = id;
+  a->tag = a->arena->tags.ids[id]->name;
+  return a;
+}
+
+/* Whether `a` is tagged `tag`, which is `t` in its arena */
+static int mpc_ast_is_tag(mpc_ast_t *a, mpc_ast_arena_t *m, mpc_tag_t *t, const char *tag) {
+  if (a->arena && a->arena == m) { return t && a->tag_id == t->id; }
+  return strcmp(a->tag, tag) == 0;
+}
+
+static int mpc_tag_scan(const char *s, const char *tag) {
+  const char *e;
+  for (;; s = e + 1) {
+    e = strchr(s, '|');
+    if (e == NULL) { return strcmp(s, tag) == 0; }
+    if ((size_t)(e - s) == strlen(tag) && memcmp(s, tag, e - s) == 0) { return 1; }
+  }
+}
+
+int mpc_ast_has_tag(mpc_ast_t *a, const char *tag) {
+
+  mpc_tag_t *t, *q;
+
+  if (a->arena == NULL) { return mpc_tag_scan(a->tag, tag); }
+
+  t = a->arena->tags.ids[a->tag_id];
+  q = mpc_tag_find(a->arena, tag, strlen(tag), "", 0, 0);
+
+  if (q && q->bit >= 0) { return (t->bits >> q->bit) & 1; }
+  if (q == NULL || !t->wide) { return 0; }
+  return mpc_tag_scan(t->name, tag);
+}
+/*
+** With `MPC_PARSE_ARENA` the nodes built while
+** parsing, and their contents and children, are
+** taken from large blocks owned by the parse.
+** The whole tree is freed at once when its root
+** is given to `mpc_ast_delete`, and deleting any
+** other node of it only frees what was made
+** outside the arena, so subtrees can't be kept
+** once the root has gone.
+*/
+
+enum { MPC_ARENA_BLOCK = 1 << 16 };
+
+typedef union {
+  char *prev;
+  double align;
+} mpc_arena_head_t;
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  return calloc(1, sizeof(mpc_ast_arena_t));
+}
+
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *m, size_t n) {
+
+  char *b;
+  size_t size;
+
+  n = (n + sizeof(mpc_arena_head_t) - 1) & ~(sizeof(mpc_arena_head_t) - 1);
+
+  if (m->used + n > m->size) {
+    size = n + sizeof(mpc_arena_head_t) > MPC_ARENA_BLOCK
+      ? n + sizeof(mpc_arena_head_t) : MPC_ARENA_BLOCK;
+    b = malloc(size);
+    ((mpc_arena_head_t*)b)->prev = m->block;
+    m->block = b;
+    m->size = size;
+    m->used = sizeof(mpc_arena_head_t);
+  }
+
+  b = m->block + m->used;
+  m->used += n;
+  return b;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *m) {
+
+  char *b;
+  mpc_ast_t *r = m->root;
+
+  /* Nodes made outside the arena are freed first */
+  m->root = NULL;
+  if (m->mixed && r) { mpc_ast_delete(r); }
+
+  while (m->block) {
+    b = ((mpc_arena_head_t*)m->block)->prev;
+    free(m->block);
+    m->block = b;
+  }
+  free(m->tags.ids);
+  free(m);
+}
+
+/* Hands the arena to the root of a finished parse */
+static mpc_ast_t *mpc_ast_arena_own(mpc_ast_arena_t *m, mpc_ast_t *a) {
+
+  mpc_ast_t *c;
+
+  if (a && a->arena == m) {
+    m->root = a;
+    return a;
+  }
+
+  /* Otherwise nothing may be left pointing into it */
+  c = a ? mpc_ast_copy(a) : NULL;
+  mpc_ast_delete(a);
+  mpc_ast_arena_delete(m);
+  return c;
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *m, const char *tag, const char *contents, size_t len) {
+  mpc_ast_t *a = mpc_ast_arena_alloc(m, sizeof(mpc_ast_t) + len + 1);
+  a->arena = m;
+  mpc_ast_retag(a, mpc_tag_find(m, tag, strlen(tag), "", 0, 1)->id);
+  a->contents = (char*)(a + 1);
+  memcpy(a->contents, contents, len + 1);
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  return a;
+}
+
 void mpc_ast_delete(mpc_ast_t *a) {
 
   int i;
 
   if (a == NULL) { return; }
 
+  if (a->arena && a->arena->root == a) {
+    mpc_ast_arena_delete(a->arena);
+    return;
+  }
+
+  if (a->arena && !a->arena->mixed) { return; }
+
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
   }
 
+  if (a->arena) { return; }
+
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2950,6 +4203,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2962,6 +4216,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->tag = malloc(strlen(tag) + 1);
   strcpy(a->tag, tag);
+  a->tag_id = -1;
 
   a->contents = malloc(strlen(contents) + 1);
   strcpy(a->contents, contents);
@@ -2970,6 +4225,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->children_num = 0;
   a->children = NULL;
+  a->arena = NULL;
   return a;
 
 }
@@ -3009,7 +4265,9 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 
   int i;
 
-  if (strcmp(a->tag, b->tag) != 0) { return 0; }
+  if (a->arena && a->arena == b->arena) {
+    if (a->tag_id != b->tag_id) { return 0; }
+  } else if (strcmp(a->tag, b->tag) != 0) { return 0; }
   if (strcmp(a->contents, b->contents) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
 
@@ -3021,33 +4279,77 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+
+  mpc_ast_t **children;
+
+  if (r->arena == NULL) {
+    r->children_num++;
+    r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+    r->children[r->children_num-1] = a;
+    return r;
+  }
+
+  /* Arena children can't be resized, so are moved */
+  children = mpc_ast_arena_alloc(r->arena, sizeof(mpc_ast_t*) * (r->children_num + 1));
+  if (r->children_num) { memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+  children[r->children_num++] = a;
+  r->children = children;
+  if (a && a->arena != r->arena) { r->arena->mixed = 1; }
   return r;
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+
+  mpc_ast_arena_t *m;
+  mpc_tag_t *x;
+  size_t n;
+  char *b;
+
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
-  return a;
+
+  if (a->arena == NULL) {
+    a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
+    memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
+    memmove(a->tag, t, strlen(t));
+    memmove(a->tag + strlen(t), "|", 1);
+    return a;
+  }
+
+  /* Tags are mostly added by the same parser each time */
+  m = a->arena;
+  x = m->tags.ids[a->tag_id];
+  n = strlen(t);
+  if (x->added != t || strncmp(m->tags.ids[x->added_id]->name, t, n) != 0
+  ||  m->tags.ids[x->added_id]->name[n] != '|') {
+    b = malloc(n + 2);
+    memcpy(b, t, n);
+    strcpy(b + n, "|");
+    x->added = t;
+    x->added_id = mpc_tag_find(m, b, n + 1, x->name, strlen(x->name), 1)->id;
+    free(b);
+  }
+
+  return mpc_ast_retag(a, x->added_id);
 }
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
-  return a;
+  if (a->arena == NULL) {
+    a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
+    memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
+    memmove(a->tag, t, (strlen(t)-1));
+    return a;
+  }
+  return mpc_ast_retag(a, mpc_tag_find(a->arena, t, strlen(t)-1, a->tag, strlen(a->tag), 1)->id);
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+  if (a->arena == NULL) {
+    a->tag = realloc(a->tag, strlen(t) + 1);
+    strcpy(a->tag, t);
+    return a;
+  }
+  return mpc_ast_retag(a, mpc_tag_find(a->arena, t, strlen(t), "", 0, 1)->id);
 }
 
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
@@ -3096,9 +4398,10 @@ int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
 
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
   int i;
+  mpc_tag_t *t = ast->arena ? mpc_tag_find(ast->arena, tag, strlen(tag), "", 0, 0) : NULL;
 
   for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
+    if(mpc_ast_is_tag(ast->children[i], ast->arena, t, tag)) {
       return i;
     }
   }
@@ -3112,9 +4415,10 @@ mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
 
 mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
   int i;
+  mpc_tag_t *t = ast->arena ? mpc_tag_find(ast->arena, tag, strlen(tag), "", 0, 0) : NULL;
 
   for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
+    if(mpc_ast_is_tag(ast->children[i], ast->arena, t, tag)) {
       return ast->children[i];
     }
   }
@@ -3796,6 +5100,7 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   mpca_grammar_st_t st;
   mpc_input_t *i;
   mpc_err_t *err;
+  long offset;
 
   va_list va;
   va_start(va, f);
@@ -3805,8 +5110,10 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   st.parsers = NULL;
   st.flags = flags;
 
-  i = mpc_input_new_file("<mpca_lang_file>", f);
+  offset = ftell(f);
+  i = mpc_input_new_contents("<mpca_lang_file>", f);
   err = mpca_lang_st(i, &st);
+  mpc_input_contents_done(i, f, offset);
   mpc_input_delete(i);
 
   free(st.parsers);
@@ -3881,7 +5188,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers = NULL;
   st.flags = flags;
 
-  i = mpc_input_new_file(filename, f);
+  i = mpc_input_new_contents(filename, f);
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
 
@@ -3904,6 +5211,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)    { return 1 + mpc_nodecount_unretained(p->data.regex.x, 0); }
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
@@ -3963,6 +5271,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)      { mpc_optimise_unretained(p->data.regex.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
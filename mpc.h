@@ -71,6 +71,19 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+enum {
+  MPC_PARSE_DEFAULT = 0,
+  MPC_PARSE_PACKRAT = 1,
+  MPC_PARSE_FAST    = 2,
+  MPC_PARSE_ARENA   = 4
+};
+
+int mpc_parse_mode(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, int mode);
+int mpc_parse_file_mode(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r, int mode);
+int mpc_parse_contents_mode(const char *filename, mpc_parser_t *p, mpc_result_t *r, int mode);
+
+void mpc_max_depth(int depth);
+
 /*
 ** Function Types
 */
@@ -288,6 +301,8 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int tag_id;
+  struct mpc_ast_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -299,6 +314,8 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
+int mpc_ast_has_tag(mpc_ast_t *a, const char *tag);
+
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
@@ -0,0 +1,38 @@
+# lispyc-baked has the prelude compiled in and runs it at startup
+cat > use.lispy <<'LISPY'
+(print (reverse {1 2 3}))
+LISPY
+mkdir empty
+(cd empty && "$LISPYC_BAKED" ../use.lispy | tail -n +4)
+
+# loading the prelude's file again, by either route, is a no-op, so the
+# reverse defined here survives
+cat > mine.lispy <<'LISPY'
+(fun {reverse xs} {"mine"})
+LISPY
+cat > again.lispy <<'LISPY'
+(load "prelude.lispy")
+(print (reverse {1 2 3}))
+LISPY
+echo "command line"
+"$LISPYC_BAKED" mine.lispy prelude.lispy use.lispy | tail -n +4
+echo "load"
+"$LISPYC_BAKED" mine.lispy again.lispy | tail -n +4
+
+# other files whose names end in prelude.lispy are loaded as usual
+cat > my_prelude.lispy <<'LISPY'
+(def {mine} "my prelude")
+(print "my_prelude.lispy ran")
+LISPY
+cat > use_mine.lispy <<'LISPY'
+(load "my_prelude.lispy")
+(print mine)
+LISPY
+echo "my_prelude.lispy"
+"$LISPYC_BAKED" my_prelude.lispy use.lispy | tail -n +4
+"$LISPYC_BAKED" use_mine.lispy | tail -n +4
+
+# without the startup run, loading the missing file runs the baked forms
+"$LISPYC" --save-image bare.img > /dev/null
+echo "image"
+(cd empty && "$LISPYC_BAKED" --image ../bare.img ../again.lispy | tail -n +4)
@@ -0,0 +1,44 @@
+# a cache that was cut short, has bytes appended or is damaged is
+# ignored and written again, the script prints the same either way
+cat > cached.lispy <<'LISPY'
+(def {xs} {1 "two" {3.5 four} -9223372036854775808 18446744073709551616})
+(print xs)
+LISPY
+run() {
+  "$LISPYC" cached.lispy | tail -n +4
+}
+run
+good=$(wc -c < cached.lispyc)
+cp cached.lispyc good.lispyc
+
+for n in 0 3 4 12 20 28 $((good - 1)); do
+  head -c $n good.lispyc > cached.lispyc
+  echo "truncated to $n"
+  run
+  cmp -s cached.lispyc good.lispyc || echo "cache not rewritten"
+done
+
+cp good.lispyc cached.lispyc
+printf 'junk' >> cached.lispyc
+echo "trailing bytes"
+run
+cmp -s cached.lispyc good.lispyc || echo "cache not rewritten"
+
+# header fields and node types that don't match are caught too
+poke() {
+  cp good.lispyc cached.lispyc
+  printf "$2" | dd of=cached.lispyc bs=1 seek=$1 conv=notrunc 2>/dev/null
+  echo "$3"
+  run
+  cmp -s cached.lispyc good.lispyc || echo "cache not rewritten"
+}
+poke 0 'X' "bad magic"
+poke 4 '\177' "other version"
+poke 8 '\0\0' "other source hash"
+poke 16 '\1' "other source length"
+poke 24 '\1' "other payload length"
+poke 32 '\7' "other form count"
+poke 40 '\377' "unknown node type"
+
+echo "cached run"
+run
@@ -0,0 +1,45 @@
+# an image is only used when all of it reads back, anything else is
+# refused before any file is loaded
+cat > setup.lispy <<'LISPY'
+(load "prelude.lispy")
+(def {big} (* 18446744073709551616 -3))
+LISPY
+cat > use.lispy <<'LISPY'
+(print (reverse {1 2 3}))
+(print big)
+LISPY
+"$LISPYC" --save-image good.img setup.lispy | tail -n +4
+size=$(wc -c < good.img)
+
+run() {
+  echo "$1"
+  "$LISPYC" --image test.img use.lispy > out.txt 2> err.txt
+  echo "exit $?"
+  tail -n +4 out.txt
+  cat err.txt
+}
+poke() {
+  cp good.img test.img
+  printf "$2" | dd of=test.img bs=1 seek=$1 conv=notrunc 2>/dev/null
+  run "$3"
+}
+
+cp good.img test.img
+run "saved image"
+for n in 0 4 8; do
+  head -c $n good.img > test.img
+  run "truncated to $n"
+done
+head -c $((size / 2)) good.img > test.img
+run "truncated to half"
+head -c $((size - 1)) good.img > test.img
+run "one byte short"
+cp good.img test.img
+printf 'junk' >> test.img
+run "trailing bytes"
+poke 0 'X' "bad magic"
+poke 4 '\177' "other version"
+poke 8 '\377' "damaged entry count"
+poke 9 '\377' "unknown node type"
+rm -f test.img
+run "missing image"
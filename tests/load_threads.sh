@@ -0,0 +1,29 @@
+# files given on the command line are read on several threads, they give
+# the same output, in the same order and with the same error positions,
+# as loading them one by one
+export LISPY_NO_CACHE=1
+
+# several files, given on the command line and loaded one by one
+for i in 1 2 3 4 5 6; do
+  awk -v f=$i 'BEGIN {
+    for (j = 0; j < 200; j++) printf "(def {x%d} %d)\n", j, j
+    printf "(print \"file %d\" x199)\n", f
+    if (f == 3) print "(print \"before the error\")\n(list 1\n  (2 . 3))"
+    if (f == 5) print "(print unbound)"
+  }' > f$i.lispy
+done
+cat > all.lispy <<'LISPY'
+(load "f1.lispy")
+(load "f2.lispy")
+(load "f3.lispy")
+(load "f4.lispy")
+(load "f5.lispy")
+(load "f6.lispy")
+LISPY
+echo "files one by one"
+LISPY_CPUS=1 "$LISPYC" all.lispy | tail -n +4 | tee serial.txt
+for n in 1 2 4 7; do
+  LISPY_CPUS=$n "$LISPYC" f1.lispy f2.lispy f3.lispy f4.lispy f5.lispy \
+    f6.lispy | tail -n +4 > threaded.txt
+  diff serial.txt threaded.txt > /dev/null && echo "files on $n threads: same"
+done
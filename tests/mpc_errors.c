@@ -0,0 +1,374 @@
+/*
+ * Prints what mpc makes of a few good and bad inputs to the lispy
+ * grammar, once for every parse mode. Each mode has to give the same
+ * ASTs and the same error messages, run.sh compares the output with
+ * mpc_errors.out.
+ *
+ * Files are parsed from a mapping or, when they can't be mapped, from a
+ * copy read into memory, and have to parse the same as a string.
+ *
+ * Trees parsed into an arena are edited with heap nodes and deleted a
+ * node at a time, which has to be clean under -fsanitize=address.
+ *
+ * A small grammar whose alternatives share a prefix is run in every mode
+ * too, and only the modes that disagree with the default are printed.
+ *
+ * Regexes are matched from a string where the DFA or the direct matcher
+ * runs, once more in fast mode, and from a pipe where the combinators do,
+ * and any difference from the first is printed.
+ */
+
+#include "mpc.h"
+
+static const char *inputs[] = {
+  "(+ 1 (* 2 3))",
+  "{head {1 2 3}}",
+  "(+ 1 2",
+  "(+ 1 2))",
+  "{1 2 )",
+  "(list . 1)",
+  "\"unterminated",
+  "",
+};
+
+static const struct {
+  const char *name;
+  int mode;
+} modes[] = {
+  {"default", MPC_PARSE_DEFAULT},
+  {"packrat", MPC_PARSE_PACKRAT},
+  {"fast", MPC_PARSE_FAST},
+  {"arena", MPC_PARSE_ARENA},
+  {"packrat arena", MPC_PARSE_PACKRAT | MPC_PARSE_ARENA},
+  {"packrat fast", MPC_PARSE_PACKRAT | MPC_PARSE_FAST},
+  {"fast arena", MPC_PARSE_FAST | MPC_PARSE_ARENA},
+  {"all", MPC_PARSE_PACKRAT | MPC_PARSE_FAST | MPC_PARSE_ARENA},
+};
+
+static const char *statements[] = {
+  "a:b; c:d. e!",
+  "a:b. a:b;",
+  "a:b",
+  "a:b!",
+  "a!b",
+  "x:y. z",
+  "",
+};
+
+static const char *files[] = {
+  "(+ 1 2)\n{a b}\n",
+  "(+ 1\n  (* 2 3)",
+  "",
+  NULL, /* a whole page, which isn't mapped */
+};
+
+static const struct {
+  const char *re;
+  int mode;
+  const char *input;
+} regexes[] = {
+  /* these compile to DFA tables */
+  {"[a-z]+", MPC_RE_DEFAULT, "abc1"},
+  {"[a-z]+", MPC_RE_DEFAULT, "1abc"},
+  {"-?[0-9]+", MPC_RE_DEFAULT, "-12x"},
+  {"-?[0-9]+", MPC_RE_DEFAULT, "-x"},
+  {"a*b?c{3}", MPC_RE_DEFAULT, "aabccc"},
+  {"a*b?c{3}", MPC_RE_DEFAULT, "bcc"},
+  {"[^\"]*", MPC_RE_DEFAULT, "ab\"c"},
+  {"[^\"]*", MPC_RE_DEFAULT, ""},
+  {"x|y|z", MPC_RE_DEFAULT, "zx"},
+  {"a.b", MPC_RE_DEFAULT, "a\nb"},
+  {"a.b", MPC_RE_DOTALL, "a\nb"},
+  /* these need the backtracking matcher */
+  {"(ab|a)c", MPC_RE_DEFAULT, "abc"},
+  {"(ab|a)c", MPC_RE_DEFAULT, "ac"},
+  {"(a|ab)c", MPC_RE_DEFAULT, "abc"},
+  {"(ab)*a", MPC_RE_DEFAULT, "ababa"},
+  {"x(yz)+", MPC_RE_DEFAULT, "xyzyzy"},
+  {"x(yz)+", MPC_RE_DEFAULT, "xy"},
+  {"\"(\\\\.|[^\"])*\"", MPC_RE_DEFAULT, "\"a\\\"b\" c"},
+  {"[a-c]+(d|ef)?g", MPC_RE_DEFAULT, "abefg"},
+  {"[a-c]+(d|ef)?g", MPC_RE_DEFAULT, "abeg"},
+  /* anchors are left to the combinators on both sides */
+  {"^ab$", MPC_RE_DEFAULT, "ab"},
+  {"^ab$", MPC_RE_DEFAULT, "abc"},
+};
+
+/* what a parse of a single regex gave, as one line */
+static void regex_result(char *buf, int ok, mpc_result_t *r) {
+  if (ok) {
+    char *c = r->output;
+    *buf++ = '\'';
+    for (; *c; c++) {
+      if (*c == '\n') { *buf++ = '\\'; *buf++ = 'n'; } else { *buf++ = *c; }
+    }
+    strcpy(buf, "'");
+    free(r->output);
+  } else {
+    char *e = mpc_err_string(r->error);
+    e[strcspn(e, "\n")] = '\0';
+    snprintf(buf, 256, "%s", e);
+    free(e);
+    mpc_err_delete(r->error);
+  }
+}
+
+/* whether two parses gave the same tree or the same error message */
+static int same_result(int ok, mpc_result_t *r, int ok2, mpc_result_t *r2) {
+  int same = ok == ok2;
+  if (same && ok) {
+    same = mpc_ast_eq(r->output, r2->output);
+  } else if (same) {
+    char *e = mpc_err_string(r->error);
+    char *e2 = mpc_err_string(r2->error);
+    same = strcmp(e, e2) == 0;
+    free(e);
+    free(e2);
+  }
+  if (ok2) { mpc_ast_delete(r2->output); } else { mpc_err_delete(r2->error); }
+  return same;
+}
+
+int main(void) {
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Symbol = mpc_new("symbol");
+  mpc_parser_t *String = mpc_new("string");
+  mpc_parser_t *Sexpr = mpc_new("sexpr");
+  mpc_parser_t *Qexpr = mpc_new("qexpr");
+  mpc_parser_t *Expr = mpc_new("expr");
+  mpc_parser_t *Lispy = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+            "number : /-?[0-9]+/ ;"
+            "symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;"
+            "string : /\"(\\\\.|[^\"])*\"/ ;"
+            "sexpr  : '(' <expr>* ')' ;"
+            "qexpr  : '{' <expr>* '}' ;"
+            "expr   : <number> | <symbol> | <string> | <sexpr> | <qexpr> ;"
+            "lispy  : /^/ <expr>* /$/ ;",
+            Number, Symbol, String, Sexpr, Qexpr, Expr, Lispy);
+
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    printf("input: %s\n", inputs[i]);
+    for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      mpc_result_t r;
+      printf("%s:\n", modes[j].name);
+      if (mpc_parse_mode("<test>", inputs[i], Lispy, &r, modes[j].mode)) {
+        mpc_ast_t *a = r.output;
+        mpc_ast_print_to(a, stdout);
+        /* tags are looked up the same way on heap and arena nodes */
+        printf("sexpr: %i, qexpr: %i, index: %i\n",
+               mpc_ast_has_tag(a->children[1], "sexpr"),
+               mpc_ast_has_tag(a->children[1], "qexpr"),
+               mpc_ast_get_index(a, "expr|sexpr|>"));
+        mpc_ast_delete(a);
+      } else {
+        mpc_err_print_to(r.error, stdout);
+        mpc_err_delete(r.error);
+      }
+    }
+    puts("");
+  }
+
+  {
+    mpc_result_t r, r2;
+    mpc_ast_t *a, *s;
+    mpc_parse_mode("<test>", "(+ 1 (* 2 3)) {x}", Lispy, &r, MPC_PARSE_ARENA);
+    mpc_parse("<test>", "(+ 1 (* 2 3)) {x}", Lispy, &r2);
+    a = r.output;
+    s = a->children[1];
+    printf("arena equals heap: %i\n", mpc_ast_eq(a, r2.output));
+    mpc_ast_delete(r2.output);
+
+    /* deleting a node below the root leaves its arena parts in place,
+     * before and after heap nodes are mixed in, and the root frees both */
+    mpc_ast_delete(a->children[2]);
+    mpc_ast_add_tag(s, "edited");
+    mpc_ast_tag(s->children[1], "op");
+    mpc_ast_add_child(s, mpc_ast_build(1, "heap", mpc_ast_new("leaf", "x")));
+    mpc_ast_add_child(s->children[3], mpc_ast_new("leaf", "y"));
+    mpc_ast_delete(s->children[3]->children[1]);
+    mpc_ast_print_to(a, stdout);
+    mpc_ast_delete(a);
+    puts("");
+  }
+
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    char page[4097];
+    const char *text = files[i];
+    mpc_result_t r, r2;
+    int ok;
+    FILE *f = fopen("input.lispy", "wb");
+    if (text == NULL) {
+      memset(page, ' ', 4096);
+      memcpy(page, "(+ 1 2)", 7);
+      page[4096] = '\0';
+      text = page;
+    }
+    fputs(text, f);
+    fclose(f);
+    printf("file of %i bytes:\n", (int)strlen(text));
+    ok = mpc_parse("input.lispy", text, Lispy, &r);
+    for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      int ok2 = mpc_parse_contents_mode("input.lispy", Lispy, &r2,
+                                        modes[j].mode);
+      if (!same_result(ok, &r, ok2, &r2)) {
+        printf("%s differs\n", modes[j].name);
+      }
+    }
+    if (ok) {
+      mpc_ast_print_to(r.output, stdout);
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print_to(r.error, stdout);
+      mpc_err_delete(r.error);
+    }
+  }
+
+  {
+    /* the file is left just after what was parsed */
+    mpc_result_t r;
+    FILE *f = fopen("input.lispy", "wb");
+    fputs("(a) (b c) (d)", f);
+    fclose(f);
+    f = fopen("input.lispy", "rb");
+    fseek(f, 4, SEEK_SET);
+    if (mpc_parse_file("input.lispy", f, Expr, &r)) {
+      mpc_ast_print_to(r.output, stdout);
+      mpc_ast_delete(r.output);
+    }
+    printf("left at %li\n", ftell(f));
+    fclose(f);
+    remove("input.lispy");
+
+    if (!mpc_parse_contents("input.lispy", Lispy, &r)) {
+      mpc_err_print_to(r.error, stdout);
+      mpc_err_delete(r.error);
+    }
+    puts("");
+  }
+
+  /* nesting is bounded by mpc_max_depth, not by the C stack */
+  for (int limit = 0; limit <= 1000; limit += 1000) {
+    int depth = 5000;
+    char *s = malloc(2 * depth + 1);
+    for (int k = 0; k < depth; k++) {
+      s[k] = '{';
+      s[2 * depth - 1 - k] = '}';
+    }
+    s[2 * depth] = '\0';
+    mpc_max_depth(limit);
+    for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      mpc_result_t r;
+      printf("%i deep, limit %i, %s:\n", depth, limit, modes[j].name);
+      if (mpc_parse_mode("<test>", s, Lispy, &r, modes[j].mode)) {
+        puts("parsed");
+        mpc_ast_delete(r.output);
+      } else {
+        mpc_err_print_to(r.error, stdout);
+        mpc_err_delete(r.error);
+      }
+    }
+    free(s);
+  }
+  mpc_max_depth(0);
+
+  {
+    /* and holds for input read from a pipe, and for errors found deep in */
+    int depth = 2000;
+    mpc_result_t r;
+    FILE *f = tmpfile();
+    for (int k = 0; k < depth; k++) { fputc('(', f); }
+    fputs("1 2", f);
+    for (int k = 0; k < depth; k++) { fputc(')', f); }
+    rewind(f);
+    printf("%i deep, pipe:\n", depth);
+    if (mpc_parse_pipe("<test>", f, Lispy, &r)) {
+      puts("parsed");
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print_to(r.error, stdout);
+      mpc_err_delete(r.error);
+    }
+    fclose(f);
+
+    char *s = malloc(depth + 1);
+    memset(s, '{', depth);
+    s[depth] = '\0';
+    for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      printf("%i deep, unclosed, %s:\n", depth, modes[j].name);
+      if (mpc_parse_mode("<test>", s, Lispy, &r, modes[j].mode)) {
+        mpc_ast_delete(r.output);
+      } else {
+        mpc_err_print_to(r.error, stdout);
+        mpc_err_delete(r.error);
+      }
+    }
+    free(s);
+  }
+
+  {
+    /* stmt backtracks over <pair> whenever the first choice fails */
+    mpc_parser_t *Word = mpc_new("word");
+    mpc_parser_t *Pair = mpc_new("pair");
+    mpc_parser_t *Stmt = mpc_new("stmt");
+    mpc_parser_t *Prog = mpc_new("prog");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+              "word : /[a-z]+/ ;"
+              "pair : <word> ':' <word> ;"
+              "stmt : <pair> ';' | <pair> '.' | <word> '!' ;"
+              "prog : /^/ <stmt>+ /$/ ;",
+              Word, Pair, Stmt, Prog);
+
+    for (size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); i++) {
+      mpc_result_t r;
+      int ok = mpc_parse("<test>", statements[i], Prog, &r);
+      printf("input: %s\n", statements[i]);
+      for (size_t j = 1; j < sizeof(modes) / sizeof(modes[0]); j++) {
+        mpc_result_t r2;
+        int ok2 = mpc_parse_mode("<test>", statements[i], Prog, &r2,
+                                 modes[j].mode);
+        if (!same_result(ok, &r, ok2, &r2)) {
+          printf("%s differs\n", modes[j].name);
+        }
+      }
+      if (ok) {
+        mpc_ast_print_to(r.output, stdout);
+        mpc_ast_delete(r.output);
+      } else {
+        mpc_err_print_to(r.error, stdout);
+        mpc_err_delete(r.error);
+      }
+    }
+    puts("");
+
+    mpc_cleanup(4, Word, Pair, Stmt, Prog);
+  }
+
+  for (size_t i = 0; i < sizeof(regexes) / sizeof(regexes[0]); i++) {
+    mpc_parser_t *p = mpc_expect(mpc_re_mode(regexes[i].re, regexes[i].mode),
+                                 "pattern");
+    mpc_result_t r;
+    char fast[256], slow[256], deferred[256];
+    FILE *f = tmpfile();
+    regex_result(fast, mpc_parse("<test>", regexes[i].input, p, &r), &r);
+    regex_result(deferred, mpc_parse_mode("<test>", regexes[i].input, p, &r,
+                                          MPC_PARSE_FAST), &r);
+    fputs(regexes[i].input, f);
+    rewind(f);
+    regex_result(slow, mpc_parse_pipe("<test>", f, p, &r), &r);
+    fclose(f);
+    printf("/%s/%i: %s\n", regexes[i].re, regexes[i].mode, fast);
+    if (strcmp(fast, slow) != 0) {
+      printf("  combinators gave: %s\n", slow);
+    }
+    if (strcmp(fast, deferred) != 0) {
+      printf("  fast mode gave: %s\n", deferred);
+    }
+    mpc_delete(p);
+  }
+
+  mpc_cleanup(7, Number, Symbol, String, Sexpr, Qexpr, Expr, Lispy);
+  return 0;
+}
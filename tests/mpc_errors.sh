@@ -0,0 +1,2 @@
+# mpc itself is checked by a small C program, built by make check
+"$MPC_ERRORS"
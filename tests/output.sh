@@ -0,0 +1,22 @@
+# printed output is buffered and flushed every LOUT_FLUSH bytes and at
+# exit, what comes out of a pipe or a file matches byte for byte
+awk 'BEGIN { printf "{"; for (i = 0; i < 200000; i++) printf "%s%d", i ? " " : "", i; print "}" }' > list.txt
+cat > big.lispy <<'LISPY'
+(print "start")
+(def {xs} (eval (head (read-file "list.txt"))))
+(print xs)
+(print "middle" 1.5 {a "b"})
+(print xs)
+(print "end")
+LISPY
+{
+  echo '"start" '
+  sed 's/$/ /' list.txt
+  echo '"middle" 1.5 {a "b"} '
+  sed 's/$/ /' list.txt
+  echo '"end" '
+} > expected.txt
+"$LISPYC" big.lispy | tail -n +4 > piped.txt
+cmp piped.txt expected.txt && echo "through a pipe: same, $(wc -c < piped.txt) bytes"
+"$LISPYC" big.lispy > file.txt
+tail -n +4 file.txt | cmp - expected.txt && echo "to a file: same"
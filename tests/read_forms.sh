@@ -0,0 +1,44 @@
+# read-forms reads one form per step and carries its position forward
+printf '(def {a} 1)\n\n  (+ a\n     2) ; two lines\n{x "y\nz"} (b . c)\n' > data.txt
+cat > steps.lispy <<'LISPY'
+(load "prelude.lispy")
+(fun {step s} { eval (snd s) })
+(fun {at s} { unpack (\ {o r c size mtime} {list o r c}) (trd (snd s)) })
+(def {s} (read-forms "data.txt"))
+(print (head s) (at s))
+(def {s} (step s))
+(print (head s) (at s))
+(def {s} (step s))
+(print (head s) (at s))
+(print (step s))
+LISPY
+"$LISPYC" steps.lispy | tail -n +4
+
+# the end of the file is an empty list, a position past it is refused
+printf '(a)\n; only a comment\n' > short.txt
+cat > end.lispy <<'LISPY'
+(load "prelude.lispy")
+(def {s} (read-forms "short.txt"))
+(print (eval (snd s)))
+(fun {seek o s} {
+  unpack (\ {_ r c size mtime} {read-forms "short.txt" (list o r c size mtime)})
+    (trd (snd s))
+})
+(print (seek 21 s))
+(print (seek 22 s))
+(print (seek -1 s))
+(print (read-forms "short.txt" {0 0}))
+LISPY
+"$LISPYC" end.lispy | tail -n +4
+
+# a step taken after the file changed fails instead of reading garbage
+cat > first.lispy <<'LISPY'
+(load "prelude.lispy")
+(print (show (snd (read-forms "data.txt"))))
+LISPY
+rest=$("$LISPYC" first.lispy | tail -n +4 | sed 's/^"\(.*\)" $/\1/; s/\\"/"/g')
+printf '(def {b} 2)\n' >> data.txt
+cat > later.lispy <<LISPY
+(print (eval $rest))
+LISPY
+"$LISPYC" later.lispy | tail -n +4
@@ -0,0 +1,14 @@
+# lists may nest LREADER_MAX_DEPTH (10000) deep, one more is an error
+nest() {
+  awk -v n="$1" 'BEGIN { for (i = 0; i < n; i++) printf "{"; for (i = 0; i < n; i++) printf "}"; print "" }'
+}
+nest 10000 > ok.txt
+nest 10001 > deep.txt
+cat > depth.lispy <<'LISPY'
+(def {ok} (read-file "ok.txt"))
+(print "read 10000 deep")
+(print (read-file "deep.txt"))
+LISPY
+"$LISPYC" depth.lispy | tail -n +4
+# files given on the command line are held to the same limit
+"$LISPYC" deep.txt | tail -n +4
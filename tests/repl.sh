@@ -0,0 +1,20 @@
+# the REPL reads standard input a line at a time, a form left open at
+# the end of a line is continued on the next one. The prompts are
+# dropped as whether they are written depends on the line editor.
+repl() {
+  "$LISPYC" | tail -n +4 | sed 's/lispy> //g; s/  \.\.\.> //g'
+}
+
+echo "a form over several lines"
+printf '(+ 1\n   2\n\n   3)\n(list {1\n2} ; comment\n3)\n' | repl
+
+echo "a string over several lines"
+printf '(print "a\nb")\n"two\n\nblank lines"\n' | repl
+
+echo "a syntax error drops the rest of the form and of its line"
+printf '(list 1 . 2)\n(+ 3 4)\n(list 1\n  (2 . 3)) (+ 5 5)\n(+ 6 6)\n' | repl
+printf '(list 1 2}\n{1 2 )\n)\n(+ 7 7)\n' | repl
+
+echo "input ending inside a form"
+printf '(+ 1 2)\n(+ 1\n' | repl
+printf '"open\n' | repl
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Runs each test in tests/ and compares its output with the .out file
+# next to it. name.lispy is loaded by lispyc, name.sh is run with
+# $LISPYC, $LISPYC_BAKED and $MPC_ERRORS set and is used where a test has
+# to set files up first. Tests run in a scratch copy of tests/, so caches
+# they write don't end up in the tree.
+
+dir=$(cd "$(dirname "$0")" && pwd)
+LISPYC=$(cd "$dir/.." && pwd)/lispyc
+LISPYC_BAKED=$(cd "$dir/.." && pwd)/lispyc-baked
+MPC_ERRORS=$dir/mpc_errors
+export LISPYC LISPYC_BAKED MPC_ERRORS
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+for t in "$dir"/*.lispy "$dir"/*.sh; do
+  name=$(basename "$t")
+  [ "$name" = run.sh ] && continue
+  expected="$dir/${name%.*}.out"
+
+  rm -rf "$work/run" && cp -R "$dir" "$work/run" && cp "$dir/../prelude.lispy" "$work/run/"
+  case "$name" in
+  # the first three lines are lispyc's banner
+  *.lispy) (cd "$work/run" && "$LISPYC" "$name" 2>&1 | tail -n +4) > "$work/actual" ;;
+  *.sh) (cd "$work/run" && sh "$name" 2>&1) > "$work/actual" ;;
+  esac
+
+  if diff -u "$expected" "$work/actual" > "$work/diff"; then
+    echo "PASS $name"
+  else
+    echo "FAIL $name"
+    cat "$work/diff"
+    failed=1
+  fi
+done
+
+exit $failed
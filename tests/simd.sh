@@ -0,0 +1,17 @@
+# the scalar, SSE2 and AVX2 kernels for vectors and for the reader's
+# scanning give the same output, LISPY_SIMD caps which are picked
+for simd in scalar sse2 avx2; do
+  for t in vectors show reader_errors bignum; do
+    LISPY_SIMD=$simd "$LISPYC" $t.lispy | tail -n +4 | cmp -s - $t.out &&
+      echo "$t with $simd: same"
+  done
+  # runs of whitespace, comments and strings long enough for the wide
+  # kernels, with quotes and line breaks landing inside their blocks
+  awk 'BEGIN {
+    pad = "                                                                "
+    printf "%s; a comment %s%s\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t%s", pad, pad, pad, pad
+    printf "(print \"%s\\\"quoted\\\"%s\n%s\\\\\"", "0123456789abcdefghijklmnopqrstu", pad, pad
+    printf ")%s(print {1%s\n\n%s2})\n", pad, pad, pad
+  }' > scan.lispy
+  LISPY_SIMD=$simd "$LISPYC" scan.lispy | tail -n +4
+done
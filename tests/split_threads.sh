@@ -0,0 +1,19 @@
+# a big file read in chunks on several threads gives the same output, in
+# the same order and with the same error positions, as reading it serially
+export LISPY_NO_CACHE=1
+
+# one file over the cache's size limit, cut into chunks between forms
+awk 'BEGIN {
+  for (i = 0; i < 700000; i++) {
+    printf "(def {v%d} \"%d\") ; %d\n", i % 100, i, i
+    if (i % 100000 == 0) printf "(print \"at\" %d v%d)\n", i, i % 100
+  }
+  print "(print {a \"b\\\"\" ; comment\n  c})"
+  print "(print (list 1\n  {2 . 3}))"
+}' > big.lispy
+echo "big file serially"
+LISPY_CPUS=1 "$LISPYC" big.lispy | tail -n +4 | tee serial.txt
+for n in 2 4; do
+  LISPY_CPUS=$n "$LISPYC" big.lispy | tail -n +4 > threaded.txt
+  diff serial.txt threaded.txt > /dev/null && echo "big file on $n threads: same"
+done
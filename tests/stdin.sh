@@ -0,0 +1,13 @@
+# "lispyc -" evaluates each form piped in as soon as it is read, stopping
+# at a syntax error, which is reported at its place in <stdin>
+printf '(print 1)\n(print "two\nlines")\n(def {x} 3)\n(list\n  (1 . 2))\n(print x)\n' |
+  "$LISPYC" - | tail -n +4
+
+# standard input can sit between files, which are read as usual
+printf '(def {a} "from a")\n' > a.lispy
+printf '(print a b)\n' > c.lispy
+printf '(def {b} "from stdin")\n' | "$LISPYC" a.lispy - c.lispy | tail -n +4
+
+# an error partway through the first line, and an unterminated string
+printf '(print 1) )\n(print 2)\n' | "$LISPYC" - | tail -n +4
+printf '(print 1)\n(print "never\n' | "$LISPYC" - | tail -n +4